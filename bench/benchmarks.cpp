@@ -0,0 +1,259 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// Run with "make bench", the results are written as JSON to the file named
+// by BENCH_OUT so that releases can be compared.
+
+#include <benchmark/benchmark.h>
+
+#include "jsonrpc-lean/client.h"
+#include "jsonrpc-lean/server.h"
+#include "jsonrpc-lean/util.h"
+
+#include <numeric>
+#include <string>
+#include <vector>
+
+namespace {
+
+    // Request shapes seen in practice, from the smallest to the largest
+    struct Shape {
+        const char* name;
+        std::string request;
+    };
+
+    std::string RepeatElements(const std::string& element, size_t count) {
+        std::string elements;
+        for (size_t i = 0; i < count; ++i) {
+            elements += (i == 0 ? "" : ",") + element;
+        }
+        return elements;
+    }
+
+    const std::vector<Shape>& GetCorpus() {
+        static const std::vector<Shape> corpus = {
+            { "positional", R"({"jsonrpc":"2.0","method":"add","params":[3,2],"id":1})" },
+            { "no_params", R"({"jsonrpc":"2.0","method":"ping","id":"c5b1e0d2-0f0b-4d4e-9a3e-2b8f6f1f7d11"})" },
+            { "strings", R"({"jsonrpc":"2.0","method":"concat","params":["Hello, ","World! \"escaped\" é"],"id":2})" },
+            { "named", R"({"jsonrpc":"2.0","method":"get_user","params":[{"user":"alice","fields":["name","email","groups"],"limit":20,"active":true}],"id":3})" },
+            { "array_100", R"({"jsonrpc":"2.0","method":"add_array","params":[[)" + RepeatElements("1.5", 100) + R"(]],"id":4})" },
+            { "nested", R"({"jsonrpc":"2.0","method":"echo","params":[{"order":{"id":9912,"lines":[{"sku":"A-1","qty":2,"price":9.99},{"sku":"B-7","qty":1,"price":24.5}],"shipping":{"city":"Lisbon","zip":"1000-001"}}}],"id":5})" },
+            { "notification", R"({"jsonrpc":"2.0","method":"log","params":["started"]})" },
+            { "batch_10", "[" + RepeatElements(R"({"jsonrpc":"2.0","method":"add","params":[3,2],"id":1})", 10) + "]" },
+        };
+        return corpus;
+    }
+
+    void Register(jsonrpc::Dispatcher& dispatcher) {
+        dispatcher.AddMethod("add", [](int a, int b) { return a + b; });
+        dispatcher.AddMethod("ping", []() { return true; });
+        dispatcher.AddMethod("concat", [](const std::string& a, const std::string& b) { return a + b; });
+        dispatcher.AddMethod("get_user", [](const Json::object& query) { return Json::object{ { "name", query.at("user") } }; });
+        dispatcher.AddMethod("add_array", [](const Json::array& a) {
+            return std::accumulate(a.begin(), a.end(), 0.0, [](double sum, const Json& value) { return sum + value.number_value(); });
+        });
+        dispatcher.AddMethod("echo", [](const Json& value) { return value; });
+        dispatcher.AddMethod("log", [](const std::string&) {});
+    }
+
+    void SetCorpusLabel(benchmark::State& state, const Shape& shape) {
+        state.SetLabel(shape.name);
+        state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * shape.request.size()));
+    }
+
+    void CorpusArguments(benchmark::internal::Benchmark* benchmark) {
+        for (size_t i = 0; i < GetCorpus().size(); ++i) {
+            benchmark->Arg(static_cast<int64_t>(i));
+        }
+    }
+
+} // namespace
+
+// JsonReader, down to a Request
+static void BM_ReadRequest(benchmark::State& state) {
+    const Shape& shape = GetCorpus()[state.range(0)];
+    for (auto _ : state) {
+        auto reader = jsonrpc::JsonReader::Read(jsonrpc::StringRef(shape.request));
+        if (reader->IsBatch()) {
+            auto batch = reader->ReadBatch();
+            benchmark::DoNotOptimize(batch);
+        } else {
+            auto request = reader->ReadRequest();
+            benchmark::DoNotOptimize(request);
+        }
+    }
+    SetCorpusLabel(state, shape);
+}
+BENCHMARK(BM_ReadRequest)->Apply(CorpusArguments);
+
+// From the request text to the response text
+static void BM_HandleRequest(benchmark::State& state) {
+    const Shape& shape = GetCorpus()[state.range(0)];
+    jsonrpc::Server server;
+    Register(server.GetDispatcher());
+    std::string response;
+    for (auto _ : state) {
+        response.clear();
+        server.HandleRequest(jsonrpc::StringRef(shape.request), response);
+        benchmark::DoNotOptimize(response.data());
+    }
+    SetCorpusLabel(state, shape);
+}
+BENCHMARK(BM_HandleRequest)->Apply(CorpusArguments);
+
+// Lookup and call, with as many methods registered as the argument, the
+// name given without a copy
+static void BM_DispatcherInvoke(benchmark::State& state) {
+    jsonrpc::Dispatcher dispatcher;
+    const int methods = static_cast<int>(state.range(0));
+    {
+        jsonrpc::Dispatcher::Batch batch(dispatcher);
+        for (int i = 0; i < methods; ++i) {
+            dispatcher.AddMethod("method" + std::to_string(i), [i](int a) { return a + i; });
+        }
+    }
+    const std::string name = "method" + std::to_string(methods / 2);
+    const jsonrpc::Request::Parameters params = { Json(1) };
+    const Json id(1);
+    for (auto _ : state) {
+        auto response = dispatcher.Invoke(jsonrpc::StringRef(name), params, id);
+        benchmark::DoNotOptimize(response);
+    }
+}
+BENCHMARK(BM_DispatcherInvoke)->Arg(1)->Arg(10)->Arg(1000);
+
+// An alias adds its bound parameters to the call
+static void BM_AliasInvoke(benchmark::State& state) {
+    jsonrpc::Dispatcher dispatcher;
+    Register(dispatcher);
+    dispatcher.AddAlias("add", "add_three", 3);
+    const jsonrpc::Request::Parameters params = { Json(2) };
+    const Json id(1);
+    for (auto _ : state) {
+        auto response = dispatcher.Invoke("add_three", params, id);
+        benchmark::DoNotOptimize(response);
+    }
+}
+BENCHMARK(BM_AliasInvoke);
+
+// From the request text to the response text of a method under
+// SetCacheable(), the argument being 0 for the uncached method
+static void BM_CachedHandleRequest(benchmark::State& state) {
+    const Shape& shape = GetCorpus()[3];
+    jsonrpc::Server server;
+    Register(server.GetDispatcher());
+    if (state.range(0)) {
+        server.GetDispatcher().GetMethod("get_user").SetCacheable(1024);
+    }
+    std::string response;
+    for (auto _ : state) {
+        response.clear();
+        server.HandleRequest(jsonrpc::StringRef(shape.request), response);
+        benchmark::DoNotOptimize(response.data());
+    }
+    SetCorpusLabel(state, shape);
+}
+BENCHMARK(BM_CachedHandleRequest)->Arg(0)->Arg(1);
+
+namespace {
+
+    jsonrpc::Response MakeResponse(int64_t kind) {
+        switch (kind) {
+        case 0:
+            return jsonrpc::Response(Json(5), Json(1));
+        case 1:
+            return jsonrpc::Response(Json("Hello, World!"), Json(1));
+        case 2:
+            return jsonrpc::Response(Json(Json::object{ { "name", "alice" }, { "groups", Json::array{ "admin", "dev" } }, { "age", 42 } }), Json(1));
+        default:
+            return jsonrpc::Response(jsonrpc::MethodNotFoundFault("Method not found: missing"), Json(1));
+        }
+    }
+
+    const char* RESPONSE_KINDS[] = { "int", "string", "object", "fault" };
+
+} // namespace
+
+// Building the response document, as done before Response::Write(std::string&)
+static void BM_ResponseWriteDump(benchmark::State& state) {
+    const jsonrpc::Response response = MakeResponse(state.range(0));
+    for (auto _ : state) {
+        std::string text = response.Write().dump();
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetLabel(RESPONSE_KINDS[state.range(0)]);
+}
+BENCHMARK(BM_ResponseWriteDump)->DenseRange(0, 3);
+
+static void BM_ResponseWrite(benchmark::State& state) {
+    const jsonrpc::Response response = MakeResponse(state.range(0));
+    std::string text;
+    for (auto _ : state) {
+        text.clear();
+        response.Write(text);
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetLabel(RESPONSE_KINDS[state.range(0)]);
+}
+BENCHMARK(BM_ResponseWrite)->DenseRange(0, 3);
+
+static void BM_ClientBuildRequestData(benchmark::State& state) {
+    jsonrpc::Client client;
+    for (auto _ : state) {
+        std::string request = client.BuildRequestData("concat", "Hello, ", "World!");
+        benchmark::DoNotOptimize(request.data());
+    }
+}
+BENCHMARK(BM_ClientBuildRequestData);
+
+static void BM_ClientParseResponse(benchmark::State& state) {
+    jsonrpc::Client client;
+    const std::string response = R"({"id": 1, "jsonrpc": "2.0", "result": {"groups": ["admin", "dev"], "name": "alice"}})";
+    for (auto _ : state) {
+        auto parsed = client.ParseResponse(response);
+        benchmark::DoNotOptimize(parsed);
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * response.size()));
+}
+BENCHMARK(BM_ClientParseResponse);
+
+namespace {
+
+    std::string MakeBinary(size_t size) {
+        std::string data(size, '\0');
+        uint32_t seed = 1;
+        for (auto& byte : data) {
+            seed = seed * 1103515245 + 12345;
+            byte = static_cast<char>(seed >> 16);
+        }
+        return data;
+    }
+
+} // namespace
+
+// The argument is the size of the binary data
+static void BM_Base64Encode(benchmark::State& state) {
+    const std::string data = MakeBinary(static_cast<size_t>(state.range(0)));
+    std::string text;
+    for (auto _ : state) {
+        text.clear();
+        jsonrpc::util::Base64EncodeAppend(data.data(), data.size(), text);
+        benchmark::DoNotOptimize(text.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+}
+BENCHMARK(BM_Base64Encode)->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+
+static void BM_Base64Decode(benchmark::State& state) {
+    const std::string data = MakeBinary(static_cast<size_t>(state.range(0)));
+    const std::string text = jsonrpc::util::Base64Encode(data);
+    std::string decoded;
+    for (auto _ : state) {
+        decoded.clear();
+        jsonrpc::util::Base64DecodeAppend(text.data(), text.size(), decoded);
+        benchmark::DoNotOptimize(decoded.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * data.size()));
+}
+BENCHMARK(BM_Base64Decode)->Arg(64)->Arg(4 << 10)->Arg(1 << 20);
+
+BENCHMARK_MAIN();
@@ -19,6 +19,7 @@
 
 #include "../include/jsonrpc-lean/util.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <fcntl.h>
@@ -66,6 +67,24 @@ int main(int argc, char** argv)
         auto binary = jsonrpc::util::Base64Decode(str);
         assert(binary.size() == static_cast<size_t>(res));
         assert(memcmp(buffer.get(), binary.data(), res) == 0);
+
+        // the streaming variants, in uneven chunks
+        jsonrpc::util::Base64Encoder encoder;
+        std::string streamed;
+        for (ssize_t i = 0; i < res; i += 1000) {
+          encoder.Update(buffer.get() + i, std::min<ssize_t>(1000, res - i), streamed);
+        }
+        encoder.Finish(streamed);
+        assert(streamed == str);
+
+        jsonrpc::util::Base64Decoder decoder;
+        binary.clear();
+        for (size_t i = 0; i < str.size(); i += 999) {
+          decoder.Update(str.data() + i, std::min<size_t>(999, str.size() - i), binary);
+        }
+        decoder.Finish(binary);
+        assert(binary.size() == static_cast<size_t>(res));
+        assert(memcmp(buffer.get(), binary.data(), res) == 0);
       }
     }
     else {
@@ -0,0 +1,108 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+// Measures the request rate of a SocketServer over loopback TCP: each
+// client thread keeps a window of pipelined NDJSON requests in flight.
+//
+// usage: loopbackbench [loops] [clients] [requests per client] [window]
+
+#include "../include/jsonrpc-lean/socketserver.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+	std::string Add(const std::string& a, const std::string& b) {
+		return a + b;
+	}
+
+	int Connect(uint16_t port) {
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+			std::cerr << "connect: " << strerror(errno) << std::endl;
+			std::exit(1);
+		}
+		return fd;
+	}
+
+	// Sends count requests, at most window of them unanswered at a time
+	void RunClient(uint16_t port, size_t count, size_t window) {
+		const std::string request = "{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":1,\"params\":[\"lo\",\"opback\"]}\n";
+		const int fd = Connect(port);
+
+		std::string burst;
+		size_t sent = 0;
+		size_t received = 0;
+		char buffer[65536];
+		while (received < count) {
+			burst.clear();
+			while (sent < count && sent - received < window) {
+				burst += request;
+				++sent;
+			}
+			if (!burst.empty() && write(fd, burst.data(), burst.size()) != static_cast<ssize_t>(burst.size())) {
+				std::cerr << "write: " << strerror(errno) << std::endl;
+				std::exit(1);
+			}
+
+			const ssize_t size = read(fd, buffer, sizeof(buffer));
+			if (size <= 0) {
+				std::cerr << "read: connection closed" << std::endl;
+				std::exit(1);
+			}
+			for (ssize_t i = 0; i < size; ++i) {
+				received += buffer[i] == '\n';
+			}
+		}
+		close(fd);
+	}
+
+} // namespace
+
+int main(int argc, char** argv) {
+	const size_t loops = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+	const size_t clients = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4;
+	const size_t requests = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 200000;
+	const size_t window = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 64;
+
+	jsonrpc::Server server;
+	server.GetDispatcher().AddMethod("add", &Add);
+
+	jsonrpc::SocketServer socketServer(server);
+	socketServer.SetLoops(loops);
+	socketServer.ListenTcp("127.0.0.1", 0);
+	std::thread serverThread([&socketServer] { socketServer.Run(); });
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (size_t i = 0; i < clients; ++i) {
+		threads.emplace_back(RunClient, socketServer.GetTcpPort(), requests, window);
+	}
+	for (auto& thread : threads) {
+		thread.join();
+	}
+	const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	socketServer.Stop();
+	serverThread.join();
+
+	const double total = static_cast<double>(clients * requests);
+	std::cout << loops << " loop(s), " << clients << " client(s), window " << window << ": "
+		<< static_cast<uint64_t>(total / elapsed.count()) << " requests/s, "
+		<< elapsed.count() * 1e6 * clients / total << " us/request per client" << std::endl;
+	return 0;
+}
@@ -0,0 +1,179 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_ARENA_H
+#define JSONRPC_LEAN_ARENA_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Monotonic allocator: allocations bump a pointer through a list of
+    // blocks, deallocation does nothing and Reset() drops everything at once.
+    // After a Reset() the arena keeps one block as large as everything that
+    // was used, so steady traffic stops hitting malloc altogether. It keeps
+    // up to maxKeptSize, the memory of a larger request is freed.
+    class Arena {
+    public:
+        explicit Arena(size_t blockSize = 4096, size_t maxKeptSize = 1 << 20)
+            : myBlockSize(blockSize), myMaxKeptSize(maxKeptSize), myPos(nullptr), myEnd(nullptr) {}
+
+        Arena(const Arena&) = delete;
+        Arena& operator=(const Arena&) = delete;
+
+        void* Allocate(size_t size, size_t alignment) {
+            char* p = Align(myPos, alignment);
+            if (!myPos || p > myEnd || size > static_cast<size_t>(myEnd - p)) {
+                AddBlock(size + alignment);
+                p = Align(myPos, alignment);
+            }
+            myPos = p + size;
+            return p;
+        }
+
+        void Reset() {
+            const size_t total = GetCapacity();
+            const size_t kept = std::min(total, std::max(myBlockSize, myMaxKeptSize));
+            if (myBlocks.size() == 1 && total == kept) {
+                myPos = myBlocks.front().data.get();
+                return;
+            }
+            myBlocks.clear();
+            myPos = nullptr;
+            myEnd = nullptr;
+            if (kept > 0) {
+                AddBlock(kept);
+            }
+        }
+
+        // The size of the blocks it holds
+        size_t GetCapacity() const {
+            size_t total = 0;
+            for (auto& block : myBlocks) {
+                total += block.size;
+            }
+            return total;
+        }
+
+        // The arena ArenaAllocator instances created on this thread pick up, if any
+        static Arena* GetCurrent() { return Current(); }
+
+        // One arena per thread, for the requests handled on it
+        static Arena& GetThreadArena() {
+            static thread_local Arena arena;
+            return arena;
+        }
+
+    private:
+        struct Block {
+            std::unique_ptr<char[]> data;
+            size_t size;
+        };
+
+        static char* Align(char* p, size_t alignment) {
+            return reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(p) + alignment - 1) & ~(uintptr_t(alignment) - 1));
+        }
+
+        void AddBlock(size_t minSize) {
+            const size_t size = minSize > myBlockSize ? minSize : myBlockSize;
+            myBlocks.push_back(Block{ std::unique_ptr<char[]>(new char[size]), size });
+            myPos = myBlocks.back().data.get();
+            myEnd = myPos + size;
+        }
+
+        static Arena*& Current() {
+            static thread_local Arena* current = nullptr;
+            return current;
+        }
+
+        std::vector<Block> myBlocks;
+        size_t myBlockSize;
+        size_t myMaxKeptSize;
+        char* myPos;
+        char* myEnd;
+
+        friend class ArenaScope;
+    };
+
+    // Makes arena the current one of this thread for the lifetime of the
+    // scope, and resets it at the end. Nested scopes on the same arena leave
+    // it to the outermost one; a null arena makes the scope a no-op.
+    class ArenaScope {
+    public:
+        explicit ArenaScope(Arena* arena) : myArena(arena), myPrevious(Arena::Current()) {
+            if (myArena) {
+                Arena::Current() = myArena;
+            }
+        }
+
+        ~ArenaScope() {
+            if (myArena) {
+                Arena::Current() = myPrevious;
+                if (myPrevious != myArena) {
+                    myArena->Reset();
+                }
+            }
+        }
+
+        ArenaScope(const ArenaScope&) = delete;
+        ArenaScope& operator=(const ArenaScope&) = delete;
+
+    private:
+        Arena* myArena;
+        Arena* myPrevious;
+    };
+
+    // Allocates from the arena it was given, or from the heap without one.
+    // Copies of a container always go to the heap, so values copied out of a
+    // request outlive the arena; moved containers keep the arena with them,
+    // and swapped ones exchange their arenas.
+    template<typename T>
+    class ArenaAllocator {
+    public:
+        typedef T value_type;
+        typedef std::true_type propagate_on_container_swap;
+        typedef std::false_type is_always_equal;
+
+        ArenaAllocator() noexcept : myArena(nullptr) {}
+        explicit ArenaAllocator(Arena* arena) noexcept : myArena(arena) {}
+
+        template<typename U>
+        ArenaAllocator(const ArenaAllocator<U>& other) noexcept : myArena(other.GetArena()) {}
+
+        T* allocate(size_t n) {
+            if (myArena) {
+                return static_cast<T*>(myArena->Allocate(n * sizeof(T), alignof(T)));
+            }
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        }
+
+        void deallocate(T* p, size_t) noexcept {
+            if (!myArena) {
+                ::operator delete(p);
+            }
+        }
+
+        ArenaAllocator select_on_container_copy_construction() const {
+            return ArenaAllocator();
+        }
+
+        Arena* GetArena() const { return myArena; }
+
+        template<typename U>
+        bool operator==(const ArenaAllocator<U>& other) const { return myArena == other.GetArena(); }
+        template<typename U>
+        bool operator!=(const ArenaAllocator<U>& other) const { return myArena != other.GetArena(); }
+
+    private:
+        Arena* myArena;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_ARENA_H
@@ -0,0 +1,195 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_BINARY_H
+#define JSONRPC_LEAN_BINARY_H
+
+#include "json.h"
+#include "jsonscanner.h"
+#include "parameterdecoder.h"
+#include "resultwriter.h"
+#include "util.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Binary data, sent as a base64 string. A method taking a Binary gets
+    // the parameter decoded straight from the request text into a buffer
+    // reused by the next calls on the thread, and a Binary result is
+    // encoded straight into the response.
+    //
+    // A Binary either owns its bytes or only refers to them: a result can
+    // refer to data of the method's object, as it is written out before
+    // the method is called again.
+    class Binary {
+    public:
+        Binary() : myData(nullptr), mySize(0) {}
+
+        // data must outlive the Binary
+        Binary(const char* data, size_t size) : myData(data), mySize(size) {}
+
+        explicit Binary(std::string data) : myBuffer(std::move(data)), myData(myBuffer.data()), mySize(myBuffer.size()) {}
+
+        Binary(const Binary& other) : myData(other.myData), mySize(other.mySize) {
+            if (other.IsOwner()) {
+                myBuffer = other.myBuffer;
+                myData = myBuffer.data();
+            }
+        }
+
+        Binary(Binary&& other) : myData(other.myData), mySize(other.mySize) {
+            if (other.IsOwner()) {
+                myBuffer = std::move(other.myBuffer);
+                myData = myBuffer.data();
+            }
+            other.myData = nullptr;
+            other.mySize = 0;
+        }
+
+        Binary& operator=(Binary other) {
+            const bool owner = other.IsOwner();
+            myBuffer.swap(other.myBuffer);
+            myData = owner ? myBuffer.data() : other.myData;
+            mySize = other.mySize;
+            return *this;
+        }
+
+        ~Binary() {
+            Recycle(std::move(myBuffer));
+        }
+
+        // Decodes base64 text into a buffer of the thread's pool
+        static Binary Decode(const char* str, size_t size) {
+            Binary binary;
+            binary.myBuffer = TakeBuffer(size / 4 * 3);
+            util::Base64DecodeAppend(str, size, binary.myBuffer);
+            binary.myData = binary.myBuffer.data();
+            binary.mySize = binary.myBuffer.size();
+            return binary;
+        }
+
+        // no begin() and end(), Json would take a Binary for an array
+        const char* data() const { return myData; }
+        size_t size() const { return mySize; }
+        bool empty() const { return mySize == 0; }
+
+        std::string ToString() const { return std::string(myData, mySize); }
+
+        // Moves the bytes out, without a copy when the Binary owns them
+        std::string Release() {
+            std::string data = IsOwner() ? std::move(myBuffer) : ToString();
+            myBuffer.clear();
+            myData = nullptr;
+            mySize = 0;
+            return data;
+        }
+
+        // Json(binary), for the calls that go through Json
+        Json to_json() const {
+            std::string str;
+            util::Base64EncodeAppend(myData, mySize, str, 0);
+            return Json(std::move(str));
+        }
+
+    private:
+        // Buffers kept per thread, with their capacity
+        static const size_t POOL_SIZE = 4;
+        // Larger buffers are not pooled, a thread only keeps one of them for
+        // the next large blob, up to MAX_LARGE_CAPACITY
+        static const size_t MAX_POOLED_CAPACITY = 64 << 10;
+        static const size_t MAX_LARGE_CAPACITY = 64 << 20;
+
+        struct Pool {
+            std::vector<std::string> small;
+            std::string large;
+        };
+
+        static Pool& GetPool() {
+            static thread_local Pool pool;
+            return pool;
+        }
+
+        // A buffer for about size bytes
+        static std::string TakeBuffer(size_t size) {
+            auto& pool = GetPool();
+            std::string buffer;
+            if (size > MAX_POOLED_CAPACITY) {
+                buffer.swap(pool.large);
+            } else if (!pool.small.empty()) {
+                buffer = std::move(pool.small.back());
+                pool.small.pop_back();
+            }
+            return buffer;
+        }
+
+        static void Recycle(std::string buffer) {
+            auto& pool = GetPool();
+            buffer.clear();
+            if (buffer.capacity() <= std::string().capacity()) {
+                return;
+            }
+            if (buffer.capacity() <= MAX_POOLED_CAPACITY) {
+                if (pool.small.size() < POOL_SIZE) {
+                    pool.small.push_back(std::move(buffer));
+                }
+            } else if (buffer.capacity() <= MAX_LARGE_CAPACITY && buffer.capacity() > pool.large.capacity()) {
+                pool.large.swap(buffer);
+            }
+        }
+
+        bool IsOwner() const { return myData != nullptr && myData == myBuffer.data(); }
+
+        std::string myBuffer;
+        const char* myData;
+        size_t mySize;
+    };
+
+    template<>
+    struct ParameterDecoder<Binary> {
+        static const bool IsSupported = true;
+
+        static bool Decode(StringRef value, Binary& out) {
+            if (value.empty() || value[0] != '"') {
+                return false;
+            }
+            StringRef text(value.data() + 1, value.size() - 2);
+            if (memchr(text.data(), '\\', text.size())) {
+                // e.g. \/ or the \r\n of wrapped lines
+                const std::string unescaped = JsonScanner::Unescape(text);
+                out = Binary::Decode(unescaped.data(), unescaped.size());
+            } else {
+                out = Binary::Decode(text.data(), text.size());
+            }
+            return true;
+        }
+    };
+
+    template<>
+    struct ParameterFromJson<Binary> {
+        static Binary Get(const Json& value) {
+            if (!value.is_string() && !value.is_null()) {
+                throw std::invalid_argument("not a string");
+            }
+            const std::string& text = value.string_value();
+            return Binary::Decode(text.data(), text.size());
+        }
+    };
+
+    template<>
+    struct ResultWriter<Binary> {
+        static void Write(JsonWriter& writer, const Binary& value) {
+            // the alphabet needs no escaping
+            writer.Raw('"');
+            util::Base64EncodeAppend(value.data(), value.size(), writer.GetBuffer(), 0);
+            writer.Raw('"');
+        }
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_BINARY_H
@@ -8,16 +8,26 @@
 #define JSONRPC_LEAN_CLIENT_H
 
 #include "request.h"
-#include "value.h"
+#include "json.h"
 #include "fault.h"
 #include "jsonreader.h"
 #include "response.h"
+#include "resultwriter.h"
 #include "dispatcher.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
+#include <future>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
 #include <memory>
 #include <stdexcept>
+#include <utility>
+#include <vector>
 
 namespace jsonrpc {
 
@@ -61,6 +71,297 @@ namespace jsonrpc {
             return ParseResponseInternal(aResponseData);
         }
 
+        // Pipelining: many calls can be in flight on one connection. A call
+        // built by BuildCallData() is answered by HandleResponseData(), in
+        // whatever order the responses come, or by ExpireCalls() with an
+        // internal error fault once its timeout expires. Fault responses are
+        // handed over too, not thrown. These can be used from any thread,
+        // callbacks are called without any lock held.
+        typedef std::function<void(Response)> ResponseCallback;
+        typedef std::chrono::steady_clock Clock;
+
+        // A zero timeout never expires
+        std::string BuildCallData(const std::string& methodName, const Request::Parameters& params,
+            ResponseCallback done, Clock::duration timeout = Clock::duration::zero()) {
+            const int32_t id = AddPending(std::move(done), timeout);
+            return Request::Write(methodName, params, id);
+        }
+
+        std::string BuildCallData(const std::string& methodName, const Request::Parameters& params,
+            std::future<Response>& response, Clock::duration timeout = Clock::duration::zero()) {
+            auto promise = std::make_shared<std::promise<Response>>();
+            response = promise->get_future();
+            return BuildCallData(methodName, params, [promise](Response result) { promise->set_value(std::move(result)); }, timeout);
+        }
+
+        // aResponseData holds a single response or a batch of them. Returns
+        // how many answered a call in flight, the others are dropped. Throws
+        // when aResponseData is not a valid response, without answering any.
+        size_t HandleResponseData(const std::string& aResponseData) {
+            JsonReader reader(aResponseData);
+            std::vector<Response> responses;
+            if (reader.IsBatch()) {
+                for (auto& element : reader.GetBatch()) {
+                    responses.push_back(std::move(element.ReadResponse().GetValue()));
+                }
+            } else {
+                responses.push_back(std::move(reader.ReadResponse().GetValue()));
+            }
+
+            std::vector<std::pair<ResponseCallback, Response*>> answered;
+            {
+                std::lock_guard<std::mutex> lock(myPendingMutex);
+                for (auto& response : responses) {
+                    int32_t id;
+                    if (GetCallId(response.GetId(), id)) {
+                        ResponseCallback done = TakePending(id);
+                        if (done) {
+                            answered.emplace_back(std::move(done), &response);
+                        }
+                    }
+                }
+            }
+            for (auto& call : answered) {
+                call.first(std::move(*call.second));
+            }
+            return answered.size();
+        }
+
+        // Returns how many calls timed out
+        size_t ExpireCalls(Clock::time_point now = Clock::now()) {
+            std::vector<std::pair<ResponseCallback, int32_t>> expired;
+            {
+                std::lock_guard<std::mutex> lock(myPendingMutex);
+                while (!myDeadlines.empty() && myDeadlines.begin()->first <= now) {
+                    const int32_t id = myDeadlines.begin()->second;
+                    myDeadlines.erase(myDeadlines.begin());
+                    ResponseCallback done = TakePending(id);
+                    if (done) {
+                        expired.emplace_back(std::move(done), id);
+                    }
+                }
+            }
+            for (auto& call : expired) {
+                call.first(Response(InternalErrorFault("Request timed out"), Json(call.second)));
+            }
+            return expired.size();
+        }
+
+        // When ExpireCalls() should be called next at the latest, max() when
+        // no call can expire
+        Clock::time_point GetNextDeadline() const {
+            std::lock_guard<std::mutex> lock(myPendingMutex);
+            return myDeadlines.empty() ? Clock::time_point::max() : myDeadlines.begin()->first;
+        }
+
+        size_t GetPendingCount() const {
+            std::lock_guard<std::mutex> lock(myPendingMutex);
+            return myPending.size();
+        }
+
+        // Appends calls and notifications to the JSON array of one batch
+        // request, in a buffer that is reused once cleared
+        class BatchBuilder {
+        public:
+            explicit BatchBuilder(Client& client) : myClient(client), myData("[]") {}
+
+            // Returns the id of the call
+            int32_t AddCall(const std::string& methodName, const Request::Parameters& params = {}) {
+                const int32_t id = myClient.myId++;
+                Append(methodName, params, id);
+                return id;
+            }
+
+            // Also handed to done by Client::HandleResponseData()
+            int32_t AddCall(const std::string& methodName, const Request::Parameters& params,
+                ResponseCallback done, Clock::duration timeout = Clock::duration::zero()) {
+                const int32_t id = myClient.AddPending(std::move(done), timeout);
+                Append(methodName, params, id);
+                return id;
+            }
+
+            void AddNotification(const std::string& methodName, const Request::Parameters& params = {}) {
+                Append(methodName, params, false);
+            }
+
+            // The ids of the calls, in the order they were added
+            const std::vector<int32_t>& GetIds() const { return myIds; }
+            size_t GetSize() const { return mySize; }
+
+            // The batch request, valid until the next change
+            const std::string& GetData() const { return myData; }
+
+            void Clear() {
+                myData.assign("[]", 2);
+                myIds.clear();
+                mySize = 0;
+            }
+
+        private:
+            void Append(const std::string& methodName, const Request::Parameters& params, const Json& id) {
+                // reopen the array
+                myData.pop_back();
+                if (mySize > 0) {
+                    myData.append(", ", 2);
+                }
+                Request::Write(myData, methodName, params, id);
+                myData += ']';
+                if (!id.is_bool()) {
+                    myIds.push_back(static_cast<int32_t>(id.int_value()));
+                }
+                ++mySize;
+            }
+
+            Client& myClient;
+            std::string myData;
+            std::vector<int32_t> myIds;
+            size_t mySize = 0;
+        };
+
+        // A method called over and over: everything but the id and the
+        // parameters is encoded once, by Client::PrepareCall(). Parameters
+        // are written from their C++ type, as method results are.
+        class CallTemplate {
+        public:
+            CallTemplate(Client& client, const std::string& methodName) : myClient(client) {
+                std::string tail;
+                JsonWriter writer(tail);
+                writer.Key(json::JSONRPC_NAME, true);
+                writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+                writer.Key(json::METHOD_NAME);
+                writer.String(methodName);
+                writer.Key(json::PARAMS_NAME);
+                writer.Raw('[');
+
+                // calls start with the id, which notifications do not have
+                myCallHead = "{\"id\": ";
+                myCallMiddle = ", " + tail;
+                myNotificationHead = "{" + tail;
+            }
+
+            // Replaces the contents of out, reusing its capacity, and
+            // returns the id of the call
+            template<typename... ParameterTypes>
+            int32_t Write(std::string& out, const ParameterTypes&... params) {
+                const int32_t id = myClient.myId++;
+                WriteCall(out, id, params...);
+                return id;
+            }
+
+            // Also handed to done by Client::HandleResponseData()
+            template<typename... ParameterTypes>
+            int32_t WritePipelined(std::string& out, ResponseCallback done, Clock::duration timeout, const ParameterTypes&... params) {
+                const int32_t id = myClient.AddPending(std::move(done), timeout);
+                WriteCall(out, id, params...);
+                return id;
+            }
+
+            template<typename... ParameterTypes>
+            void WriteNotification(std::string& out, const ParameterTypes&... params) {
+                out.assign(myNotificationHead);
+                JsonWriter writer(out);
+                WriteParameters(writer, true, params...);
+                writer.Raw("]}", 2);
+            }
+
+        private:
+            template<typename... ParameterTypes>
+            void WriteCall(std::string& out, int32_t id, const ParameterTypes&... params) const {
+                out.assign(myCallHead);
+                JsonWriter writer(out);
+                writer.Int(id);
+                writer.Raw(myCallMiddle.data(), myCallMiddle.size());
+                WriteParameters(writer, true, params...);
+                writer.Raw("]}", 2);
+            }
+
+            static void WriteParameters(JsonWriter&, bool) {}
+
+            // Request::Parameters are written one by one, like a Json::array
+            template<typename... RestTypes>
+            static void WriteParameters(JsonWriter& writer, bool first, const Request::Parameters& params, const RestTypes&... rest) {
+                for (auto& param : params) {
+                    WriteParameters(writer, first, param);
+                    first = false;
+                }
+                WriteParameters(writer, first, rest...);
+            }
+
+            template<typename FirstType, typename... RestTypes>
+            static void WriteParameters(JsonWriter& writer, bool first, const FirstType& param, const RestTypes&... rest) {
+                if (!first) {
+                    writer.Raw(", ", 2);
+                }
+                ResultWriter<FirstType>::Write(writer, param);
+                WriteParameters(writer, false, rest...);
+            }
+
+            Client& myClient;
+            std::string myCallHead;
+            std::string myCallMiddle;
+            std::string myNotificationHead;
+        };
+
+        CallTemplate PrepareCall(const std::string& methodName) {
+            return CallTemplate(*this, methodName);
+        }
+
+        // The responses to the calls of batch, in the order they were added.
+        // Results are kept as JSON text until asked for, and faults are not
+        // thrown. A call without response, e.g. when the server could not
+        // read the batch, gets the fault answering the whole batch or an
+        // invalid request fault. The server answers a batch of notifications
+        // only with nothing, which gives no responses.
+        std::vector<Response> ParseBatchResponse(const std::string& aResponseData, const BatchBuilder& batch) {
+            std::vector<Response> read;
+            // a fault without id answering the whole batch
+            bool batchFault = false;
+            if (aResponseData.find_first_not_of(" \t\r\n") != std::string::npos) {
+                JsonReader reader(aResponseData);
+                if (reader.IsBatch()) {
+                    for (auto& element : reader.GetBatch()) {
+                        read.push_back(std::move(element.ReadResponse().GetValue()));
+                    }
+                } else {
+                    read.push_back(std::move(reader.ReadResponse().GetValue()));
+                    batchFault = read[0].IsFault() && read[0].GetId().is_null();
+                }
+            }
+
+            const std::vector<int32_t>& ids = batch.GetIds();
+            std::vector<size_t> found(ids.size(), read.size());
+            size_t next = 0;
+            for (size_t i = 0; i < read.size(); ++i) {
+                int32_t id;
+                if (!GetCallId(read[i].GetId(), id)) {
+                    continue;
+                }
+                // responses mostly come in order, start after the last one found
+                for (size_t n = 0; n < ids.size(); ++n, ++next) {
+                    if (next >= ids.size()) {
+                        next = 0;
+                    }
+                    if (ids[next] == id) {
+                        found[next++] = i;
+                        break;
+                    }
+                }
+            }
+
+            std::vector<Response> responses;
+            responses.reserve(ids.size());
+            for (size_t i = 0; i < ids.size(); ++i) {
+                if (found[i] < read.size()) {
+                    responses.push_back(std::move(read[found[i]]));
+                } else if (batchFault) {
+                    responses.emplace_back(read[0].GetFaultCode(), read[0].GetFaultString(), Json(ids[i]));
+                } else {
+                    responses.emplace_back(InvalidRequestFault("No response"), Json(ids[i]));
+                }
+            }
+            return responses;
+        }
+
         Client(const Client&) = delete;
         Client& operator=(const Client&) = delete;
         Client(Client&&) = delete;
@@ -92,10 +393,63 @@ namespace jsonrpc {
             auto reader = JsonReader(aResponseData);
             Response response = reader.GetResponse();
             response.ThrowIfFault();
-            return std::move(response);
+            return response;
+        }
+
+        // The calls in flight by id, whatever the order they are answered
+        // in: a call left unanswered holds nothing but its own entry. Each
+        // deadline is dropped along with its call.
+        int32_t AddPending(ResponseCallback done, Clock::duration timeout) {
+            std::lock_guard<std::mutex> lock(myPendingMutex);
+            int32_t id = myId++;
+            // once the ids wrapped around, skip the calls still in flight
+            while (myPending.count(id) != 0) {
+                id = myId++;
+            }
+            Pending& pending = myPending[id];
+            pending.done = std::move(done);
+            pending.deadline = Clock::time_point::max();
+            if (timeout != Clock::duration::zero()) {
+                pending.deadline = Clock::now() + timeout;
+                myDeadlines.emplace(pending.deadline, id);
+            }
+            return id;
         }
 
-        int32_t myId;
+        ResponseCallback TakePending(int32_t id) {
+            auto found = myPending.find(id);
+            if (found == myPending.end()) {
+                return nullptr;
+            }
+            ResponseCallback done = std::move(found->second.done);
+            if (found->second.deadline != Clock::time_point::max()) {
+                myDeadlines.erase(Deadline(found->second.deadline, id));
+            }
+            myPending.erase(found);
+            return done;
+        }
+
+        static bool GetCallId(const Json& id, int32_t& callId) {
+            const double value = id.number_value();
+            if (!id.is_number() || value < INT32_MIN || value > INT32_MAX) {
+                return false;
+            }
+            callId = static_cast<int32_t>(value);
+            return callId == value;
+        }
+
+        typedef std::pair<Clock::time_point, int32_t> Deadline;
+
+        struct Pending {
+            ResponseCallback done;
+            // max() when the call never expires
+            Clock::time_point deadline;
+        };
+
+        std::atomic<int32_t> myId;
+        mutable std::mutex myPendingMutex;
+        std::unordered_map<int32_t, Pending> myPending;
+        std::set<Deadline> myDeadlines;
     };
 
 } // namespace jsonrpc
@@ -0,0 +1,142 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_CONCURRENCYLIMIT_H
+#define JSONRPC_LEAN_CONCURRENCYLIMIT_H
+
+#include "threadpool.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace jsonrpc {
+
+    // Bounds how many calls of a method run at the same time. Synchronous
+    // callers wait for a free slot in a Slot; asynchronous ones Post() the
+    // call, which runs right away or once a running call calls Release().
+    // Slots are handed over in the order they were asked for. A queued call
+    // is posted to the pool given, or without one run on the thread
+    // releasing its slot.
+    class ConcurrencyLimit {
+    public:
+        // pool must outlive the calls posted
+        explicit ConcurrencyLimit(size_t maxConcurrency, ThreadPool* pool = nullptr)
+            : myMax(maxConcurrency), myRunning(0), myPool(pool) {}
+
+        ConcurrencyLimit(const ConcurrencyLimit&) = delete;
+        ConcurrencyLimit& operator=(const ConcurrencyLimit&) = delete;
+
+        size_t GetMaxConcurrency() const { return myMax; }
+
+        // Holds a slot for its lifetime, a null limit holds nothing
+        class Slot {
+        public:
+            explicit Slot(ConcurrencyLimit* limit) : myLimit(limit) {
+                if (myLimit) {
+                    myLimit->Acquire();
+                }
+            }
+
+            ~Slot() {
+                if (myLimit) {
+                    myLimit->Release();
+                }
+            }
+
+            Slot(const Slot&) = delete;
+            Slot& operator=(const Slot&) = delete;
+
+        private:
+            ConcurrencyLimit* myLimit;
+        };
+
+        void Acquire() {
+            std::unique_lock<std::mutex> lock(myMutex);
+            if (myRunning < myMax && myQueue.empty()) {
+                ++myRunning;
+                return;
+            }
+            bool granted = false;
+            myQueue.push_back(Waiter{ nullptr, &granted });
+            myCondition.wait(lock, [&granted] { return granted; });
+        }
+
+        // call holds a slot until it calls Release()
+        void Post(std::function<void()> call) {
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                if (myRunning >= myMax || !myQueue.empty()) {
+                    myQueue.push_back(Waiter{ std::move(call), nullptr });
+                    return;
+                }
+                ++myRunning;
+            }
+            call();
+        }
+
+        void Release() {
+            std::function<void()> next;
+            {
+                std::lock_guard<std::mutex> lock(myMutex);
+                if (myQueue.empty()) {
+                    --myRunning;
+                    return;
+                }
+                // the slot goes to the next one waiting
+                Waiter waiter = std::move(myQueue.front());
+                myQueue.pop_front();
+                if (waiter.granted) {
+                    *waiter.granted = true;
+                    myCondition.notify_all();
+                    return;
+                }
+                next = std::move(waiter.call);
+            }
+            if (myPool) {
+                myPool->Post(std::move(next));
+            } else {
+                RunQueued(std::move(next));
+            }
+        }
+
+    private:
+        // A queued asynchronous call, or the flag of a synchronous caller
+        struct Waiter {
+            std::function<void()> call;
+            bool* granted;
+        };
+
+        // Calls that complete right away release from within the previous
+        // call, so they are run one after the other rather than nested
+        static void RunQueued(std::function<void()> call) {
+            static thread_local std::deque<std::function<void()>>* pending = nullptr;
+            if (pending) {
+                pending->push_back(std::move(call));
+                return;
+            }
+            std::deque<std::function<void()>> calls;
+            calls.push_back(std::move(call));
+            pending = &calls;
+            struct Reset {
+                ~Reset() { pending = nullptr; }
+            } reset;
+            while (!calls.empty()) {
+                std::function<void()> next = std::move(calls.front());
+                calls.pop_front();
+                next();
+            }
+        }
+
+        size_t myMax;
+        size_t myRunning;
+        ThreadPool* myPool;
+        std::deque<Waiter> myQueue;
+        std::mutex myMutex;
+        std::condition_variable myCondition;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_CONCURRENCYLIMIT_H
@@ -7,9 +7,18 @@
 #ifndef JSONRPC_LEAN_DISPATCHER_H
 #define JSONRPC_LEAN_DISPATCHER_H
 
+#include "binary.h"
+#include "concurrencylimit.h"
+#include "expected.h"
 #include "fault.h"
+#include "methodindex.h"
+#include "methodstats.h"
+#include "parameterdecoder.h"
+#include "rcu.h"
 #include "request.h"
+#include "resultcache.h"
 #include "response.h"
+#include "resultwriter.h"
 
 //#if __cplusplus <= 201103L
 #include "integer_seq.h"
@@ -19,35 +28,104 @@
 //} // namespace std
 //#endif
 
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <future>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <typeinfo>
 #include <utility>
 #include <vector>
 
 namespace jsonrpc {
 
+    // Completes an asynchronous method call, from any thread. It is copyable
+    // and all the copies complete the same call: the first SetResult() or
+    // SetFault() answers it, later ones are ignored. A call whose copies
+    // are all destroyed before completing it is answered with an internal
+    // error.
+    class AsyncResult {
+    public:
+        typedef std::function<void(Response)> Callback;
+
+        AsyncResult(Callback callback, Json id) : myState(std::make_shared<State>()) {
+            myState->callback = std::move(callback);
+            myState->id = std::move(id);
+        }
+
+        void SetResult(Json result) {
+            if (!myState->completed.exchange(true)) {
+                myState->callback(Response(std::move(result), std::move(myState->id)));
+            }
+        }
+
+        void SetFault(const Fault& fault) {
+            Complete(fault.GetCode(), fault.GetString());
+        }
+
+        bool IsCompleted() const { return myState->completed; }
+
+    private:
+        struct State {
+            ~State() {
+                if (!completed) {
+                    callback(Response(Fault::INTERNAL_ERROR, "Internal error: the method did not complete the call", std::move(id)));
+                }
+            }
+
+            Callback callback;
+            Json id;
+            std::atomic<bool> completed{ false };
+        };
+
+        // Unlike Fault, this takes the reserved codes too
+        void Complete(int32_t faultCode, const std::string& faultString) {
+            if (!myState->completed.exchange(true)) {
+                myState->callback(Response(faultCode, faultString, std::move(myState->id)));
+            }
+        }
+
+        std::shared_ptr<State> myState;
+
+        friend class Dispatcher;
+    };
+
+    class Dispatcher;
+
+    // Once added to a Dispatcher the wrapper holds the settings of the
+    // method: its setters change it and publish a copy for the calls to run,
+    // calls already started keep running the copy they found. It is freed
+    // once the method is replaced or removed.
     class MethodWrapper {
     public:
         typedef std::function<Json(const Request::Parameters&)> Method;
 
-        explicit MethodWrapper(Method method) : myMethod(method) {}
+        explicit MethodWrapper(Method method) : myMethod(method), myStats(std::make_shared<MethodStats>()) {}
 
-        MethodWrapper(const MethodWrapper&) = delete;
         MethodWrapper& operator=(const MethodWrapper&) = delete;
 
+        // The name it was added under, empty until then
+        const std::string& GetName() const { return myName; }
+
         bool IsHidden() const { return myIsHidden; }
-        void SetHidden(bool hidden = true) { myIsHidden = hidden; }
+        MethodWrapper& SetHidden(bool hidden = true) {
+            return Update([&](MethodWrapper& method) { method.myIsHidden = hidden; });
+        }
 
         MethodWrapper& SetHelpText(std::string help) {
-            myHelpText = std::move(help);
-            return *this;
+            return Update([&](MethodWrapper& method) { method.myHelpText = help; });
         }
 
         const std::string& GetHelpText() const { return myHelpText; }
 
         template<typename... ParameterTypes>
         MethodWrapper& AddSignature(Json::Type returnType, ParameterTypes... parameterTypes) {
-            mySignatures.emplace_back(std::initializer_list < Json::Type > {returnType, parameterTypes...});
-            return *this;
+            const std::vector<Json::Type> signature{ returnType, parameterTypes... };
+            return Update([&](MethodWrapper& method) { method.mySignatures.push_back(signature); });
         }
 
         const std::vector<std::vector<Json::Type>>&
@@ -57,25 +135,122 @@ namespace jsonrpc {
             return myMethod(params);
         }
 
+        // Same as the Method, but writes the JSON text of the result instead
+        // of returning it as a Json
+        typedef std::function<void(const Request::Parameters& params, std::string& result)> SerializedMethod;
+
+        bool HasSerializedMethod() const { return static_cast<bool>(mySerializedMethod); }
+        void SetSerializedMethod(SerializedMethod method) {
+            Update([&](MethodWrapper& wrapper) { wrapper.mySerializedMethod = method; });
+        }
+
+        void operator()(const Request::Parameters& params, std::string& result) const {
+            mySerializedMethod(params, result);
+        }
+
+        // Calls the method with its parameters decoded straight from the
+        // JSON text of the params array, and writes the JSON text of the
+        // result. Returns false, without calling it, when the parameters
+        // cannot be decoded that way.
+        typedef std::function<bool(StringRef params, std::string& result)> TypedMethod;
+
+        bool HasTypedMethod() const { return static_cast<bool>(myTypedMethod); }
+        void SetTypedMethod(TypedMethod method) {
+            Update([&](MethodWrapper& wrapper) { wrapper.myTypedMethod = method; });
+        }
+
+        bool operator()(StringRef params, std::string& result) const {
+            return myTypedMethod(params, result);
+        }
+
+        // Starts the method and returns, the method completes result later.
+        // params are only valid during the call, copy what must outlive it.
+        typedef std::function<void(const Request::Parameters& params, AsyncResult result)> AsyncMethod;
+
+        bool IsAsync() const { return static_cast<bool>(myAsyncMethod); }
+        void SetAsyncMethod(AsyncMethod method) {
+            Update([&](MethodWrapper& wrapper) { wrapper.myAsyncMethod = method; });
+        }
+
+        void operator()(const Request::Parameters& params, AsyncResult result) const {
+            myAsyncMethod(params, std::move(result));
+        }
+
         MethodWrapper& SetNumberOfPara(int n) {
-            myNumberOfPara = n;
-            return *this;
+            return Update([&](MethodWrapper& method) { method.myNumberOfPara = n; });
         }
         int GetNumberOfPara() const { return myNumberOfPara; }
 
         MethodWrapper& SetLeastOfPara(int n) {
-            myLeastOfPara = n;
-            return *this;
+            return Update([&](MethodWrapper& method) { method.myLeastOfPara = n; });
         }
         int GetLeastOfPara() const { return myLeastOfPara; }
 
+        // Calls with fewer parameters are answered with an invalid parameters
+        // fault by the Dispatcher, without calling the method
+        MethodWrapper& SetRequiredParameters(size_t n) {
+            return Update([&](MethodWrapper& method) { method.myRequiredParameters = n; });
+        }
+        size_t GetRequiredParameters() const { return myRequiredParameters; }
+
+        // At most n calls of the method run at the same time, 0 for no limit.
+        // Invoke() waits for its turn, InvokeAsync() queues the call and
+        // returns. Queued calls are posted to pool once their turn comes, or
+        // without one made by the thread completing the previous call; pool
+        // must outlive the calls of the method. Calls already started count
+        // against the previous limit.
+        MethodWrapper& SetMaxConcurrency(size_t n, ThreadPool* pool = nullptr) {
+            return Update([&](MethodWrapper& method) {
+                method.myConcurrencyLimit = n > 0 ? std::make_shared<ConcurrencyLimit>(n, pool) : nullptr;
+            });
+        }
+        size_t GetMaxConcurrency() const { return myConcurrencyLimit ? myConcurrencyLimit->GetMaxConcurrency() : 0; }
+
+        ConcurrencyLimit* GetConcurrencyLimit() const { return myConcurrencyLimit.get(); }
+
+        // The Dispatcher keeps the results of up to maxEntries calls, 0 for
+        // none, and answers the next calls with the same parameters from
+        // them for ttl, 0 for as long as they are kept. Only for methods
+        // whose result only depends on their parameters; faults are not
+        // kept. Calls answered from it do not wait for their turn under
+        // SetMaxConcurrency(). Setting it again starts from an empty cache.
+        MethodWrapper& SetCacheable(size_t maxEntries, std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+            return Update([&](MethodWrapper& method) {
+                method.myResultCache = maxEntries > 0 ? std::make_shared<ResultCache>(maxEntries, ttl) : nullptr;
+            });
+        }
+
+        ResultCache* GetResultCache() const { return myResultCache.get(); }
+
+        // Calls made through the Dispatcher, see also Dispatcher::GetStats().
+        // They are shared by all the copies of the method.
+        MethodStats& GetStats() const { return *myStats; }
+
     private:
+        // only the Dispatcher copies a wrapper, to publish it
+        MethodWrapper(const MethodWrapper&) = default;
+
+        // Applies change, and publishes it when added to a Dispatcher
+        MethodWrapper& Update(const std::function<void(MethodWrapper&)>& change);
+
         Method myMethod;
+        SerializedMethod mySerializedMethod;
+        TypedMethod myTypedMethod;
+        AsyncMethod myAsyncMethod;
         bool   myIsHidden = false;
         std::string myHelpText;
         std::vector<std::vector<Json::Type>> mySignatures;
         int    myNumberOfPara {0};
         int    myLeastOfPara  {99};
+        size_t myRequiredParameters = 0;
+        std::shared_ptr<ConcurrencyLimit> myConcurrencyLimit;
+        std::shared_ptr<ResultCache> myResultCache;
+        std::shared_ptr<MethodStats> myStats;
+        std::string myName;
+        // expires with the Dispatcher, unset in the published copies
+        std::weak_ptr<Dispatcher*> myDispatcher;
+
+        friend class Dispatcher;
     };
 
     struct AliasWrapper{
@@ -84,6 +259,36 @@ namespace jsonrpc {
       // Todo(jsiloto): Add generalize for more parameters
     };
 
+    // A method resolved once by Dispatcher::Resolve, so that transports can
+    // cache it and skip the lookup: the wrapper to call, the alias parameters
+    // to prepend and the padding of calls with fewer parameters. It owns all
+    // of them. Once the registrations change, Invoke() resolves its name
+    // again on every call: resolve it again to get rid of the lookup.
+    class MethodHandle {
+    public:
+        MethodHandle() : myLeastOfPara(0), myNumberOfPara(0), myGeneration(0) {}
+
+        // The name of the method or of the missing one the handle resolved to
+        const std::string& GetName() const {
+            return myMethod ? myMethod->GetName() : myAlias ? myAlias->name : myName;
+        }
+
+        explicit operator bool() const { return static_cast<bool>(myMethod); }
+        const MethodWrapper* GetMethod() const { return myMethod.get(); }
+
+    private:
+        std::shared_ptr<const MethodWrapper> myMethod;
+        std::shared_ptr<const AliasWrapper> myAlias;
+        size_t myLeastOfPara;
+        size_t myNumberOfPara;
+        // the name it was resolved from, set for the handles that outlive
+        // the call and for the missing methods
+        std::string myName;
+        uint64_t myGeneration;
+
+        friend class Dispatcher;
+    };
+
     template<typename> struct ToStdFunction;
 
     template<typename ReturnType, typename... ParameterTypes>
@@ -115,14 +320,47 @@ namespace jsonrpc {
             decltype(&MethodType::operator()) > ::Type Type;
     };
 
+    // Methods can be added, replaced and removed while requests are being
+    // dispatched: the registrations are an immutable table that every change
+    // copies and publishes, so that Invoke() looks methods up without
+    // locking. The calls own the method they found, and keep running it
+    // whatever changes meanwhile, methods included.
     class Dispatcher {
     public:
+        Dispatcher() : myRegistry(std::unique_ptr<const Registry>(new Registry())), myGeneration(1), myBatches(0),
+            mySelf(std::make_shared<Dispatcher*>(this)) {}
+
+        // Registers methods and aliases in bulk: the changes made while a
+        // batch exists are published together once the last one ends, so
+        // the table is copied and indexed once instead of once per change.
+        // Calls see none of them until then, ReplaceMethod() included.
+        class Batch {
+        public:
+            explicit Batch(Dispatcher& dispatcher) : myDispatcher(dispatcher) {
+                std::lock_guard<std::mutex> lock(myDispatcher.myWriteMutex);
+                ++myDispatcher.myBatches;
+            }
+
+            ~Batch() {
+                std::lock_guard<std::mutex> lock(myDispatcher.myWriteMutex);
+                --myDispatcher.myBatches;
+                myDispatcher.Commit();
+            }
+
+            Batch(const Batch&) = delete;
+            Batch& operator=(const Batch&) = delete;
+
+        private:
+            Dispatcher& myDispatcher;
+        };
+
         std::vector<std::string> GetMethodNames(bool includeHidden = false) const {
+            RcuPtr<Registry>::ReadScope registry(myRegistry);
             std::vector<std::string> names;
-            names.reserve(myMethods.size());
+            names.reserve(registry->methods.size());
 
-            for (auto& method : myMethods) {
-                if (includeHidden || !method.second.IsHidden()) {
+            for (auto& method : registry->methods) {
+                if (includeHidden || !method.second->IsHidden()) {
                     names.emplace_back(method.first);
                 }
             }
@@ -130,19 +368,62 @@ namespace jsonrpc {
             return names;
         }
 
+        // Valid until the method is replaced or removed
         MethodWrapper& GetMethod(const std::string& name) {
-            return myMethods.at(name);
+            std::lock_guard<std::mutex> lock(myWriteMutex);
+            return *myMethods.at(name);
         }
 
-        MethodWrapper& AddMethod(std::string name, MethodWrapper::Method method) {
-            auto result = myMethods.emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(std::move(name)),
-                std::forward_as_tuple(std::move(method)));
-            if (!result.second) {
-                throw std::invalid_argument(name + ": method already added");
+        // Snapshots of the call statistics of every method, hidden ones too
+        std::map<std::string, MethodStats::Snapshot> GetStats() const {
+            RcuPtr<Registry>::ReadScope registry(myRegistry);
+            std::map<std::string, MethodStats::Snapshot> stats;
+            for (auto& method : registry->methods) {
+                stats.emplace(method.first, method.second->GetStats().GetSnapshot());
             }
-            return result.first->second;
+            return stats;
+        }
+
+        // Adds a hidden method returning GetStats() as an object of
+        // MethodStats::Snapshot::ToJson() by method name
+        MethodWrapper& AddStatsMethod(std::string name = "system.stats") {
+            MethodWrapper::Method stats = [this](const Request::Parameters&) -> Json {
+                Json::object methods;
+                for (auto& method : GetStats()) {
+                    methods[method.first] = method.second.ToJson();
+                }
+                return methods;
+            };
+            auto method = std::make_shared<MethodWrapper>(std::move(stats));
+            method->SetHidden();
+            return Publish(std::move(name), std::move(method), false);
+        }
+
+        MethodWrapper& AddMethod(std::string name, MethodWrapper::Method method) {
+            return Publish(std::move(name), std::make_shared<MethodWrapper>(std::move(method)), false);
+        }
+
+        // The method completes the call through its AsyncResult, so a thread
+        // is not held while it waits, as InvokeAsync() and
+        // Server::HandleRequestAsync() do. Invoke() does not wait: unless
+        // the method completed the call before returning, it answers it with
+        // a server error and ignores the later completion.
+        MethodWrapper& AddAsyncMethod(std::string name, MethodWrapper::AsyncMethod method) {
+            MethodWrapper::Method now = [method](const Request::Parameters& params) -> Json {
+                auto promise = std::make_shared<std::promise<Response>>();
+                auto future = promise->get_future();
+                AsyncResult result([promise](Response response) { promise->set_value(std::move(response)); }, Json());
+                method(params, result);
+                // the completion may need this very thread, so it is not waited for
+                result.Complete(Fault::SERVER_ERROR_CODE_DEFAULT, "Asynchronous method not completed, call it asynchronously");
+                // set already, or being set by the completion that won
+                Response response = future.get();
+                response.ThrowIfFault();
+                return std::move(response.GetResult());
+            };
+            auto wrapper = std::make_shared<MethodWrapper>(std::move(now));
+            wrapper->SetAsyncMethod(std::move(method));
+            return Publish(std::move(name), std::move(wrapper), false);
         }
 
         template<typename MethodType>
@@ -152,7 +433,7 @@ namespace jsonrpc {
             //static_assert(!std::is_bind_expression<MethodType>::value,
             //    "Use AddMethod with 3 arguments to add member method");
             typename StdFunction<MethodType, std::is_class<MethodType>::value>::Type function(std::move(method));
-            return AddMethodInternal(std::move(name), std::move(function));
+            return Publish(std::move(name), MakeMethod(std::move(function)), false);
         }
 
         template<typename T>
@@ -170,7 +451,7 @@ namespace jsonrpc {
             std::function<ReturnType(ParameterTypes...)> function = [&instance, method](ParameterTypes&&... params) -> ReturnType {
                 return (instance.*method)(std::forward<ParameterTypes>(params)...);
             };
-            return AddMethodInternal(std::move(name), std::move(function));
+            return Publish(std::move(name), MakeMethod(std::move(function)), false);
         }
 
         template<typename ReturnType, typename T, typename... ParameterTypes>
@@ -178,119 +459,573 @@ namespace jsonrpc {
             std::function<ReturnType(ParameterTypes...)> function = [&instance, method](ParameterTypes&&... params) -> ReturnType {
                 return (instance.*method)(std::forward<ParameterTypes>(params)...);
             };
-            return AddMethodInternal(std::move(name), std::move(function));
+            return Publish(std::move(name), MakeMethod(std::move(function)), false);
+        }
+
+        // Like AddMethod, but atomically takes the place of the method of
+        // that name when there is one: each call runs either the previous or
+        // the new method, and none starts the previous one once this returns
+        MethodWrapper& ReplaceMethod(std::string name, MethodWrapper::Method method) {
+            return Publish(std::move(name), std::make_shared<MethodWrapper>(std::move(method)), true);
+        }
+
+        template<typename MethodType>
+        MethodWrapper& ReplaceMethod(std::string name, MethodType method) {
+            typename StdFunction<MethodType, std::is_class<MethodType>::value>::Type function(std::move(method));
+            return Publish(std::move(name), MakeMethod(std::move(function)), true);
         }
 
         void RemoveMethod(const std::string& name) {
+            std::lock_guard<std::mutex> lock(myWriteMutex);
             myMethods.erase(name);
+            GetPending().methods.erase(name);
+            Commit();
         }
 
         template<typename... ParameterTypes>
         void AddAlias(const std::string& method, const std::string alias, ParameterTypes... parameters){
           AliasWrapper a = AddAliasInternal(method, parameters...);
-          myAliases.emplace(alias, a);
+          std::lock_guard<std::mutex> lock(myWriteMutex);
+          GetPending().aliases.emplace(alias, std::make_shared<const AliasWrapper>(std::move(a)));
+          Commit();
         }
 
 
 
+        MethodHandle Resolve(const std::string& name) const {
+            return Resolve(StringRef(name));
+        }
+
+        MethodHandle Resolve(StringRef name) const {
+            MethodHandle handle = Find(name);
+            handle.myName = name.str();
+            return handle;
+        }
+
+        // Server hands its requests to this one, so that methods registered
+        // with their C++ signature can decode the parameters themselves.
+        // Otherwise it goes through Invoke(handle, parameters, id). The
+        // requests of a subclass, which may override the virtual Invoke(),
+        // go through that one instead.
+        Response Invoke(Request& request) const {
+            if (IsSubclass()) {
+                return Invoke(request.GetMethodName(), request.TakeParameters(), request.GetId());
+            }
+            MethodHandle handle = Find(request.GetMethodName());
+            ConcurrencyLimit::Slot slot(GetConcurrencyLimit(handle));
+            return Measure(handle, [&]() { return Call(handle, request); });
+        }
+
         virtual Response Invoke(std::string name, Request::Parameters parameters, const Json& id) const {
-            try {
-                // find alias if existing
-                auto alias = myAliases.find(name);
-                if(alias != myAliases.end()){
-                    // resolve alias
-                    name = alias->second.name;
-                    //parameters.push_front(alias->second.parameters.front());
-                    // concatenate parameters
-                    auto pars = alias->second.parameters;
-                    while(!pars.empty()){
-                        parameters.push_front(pars.back());
-                        pars.pop_back();
+            return Invoke(StringRef(name), std::move(parameters), id);
+        }
+
+        // Same without copying the name. Not virtual: the overrides of the
+        // one above do not see these calls.
+        Response Invoke(StringRef name, Request::Parameters parameters, const Json& id) const {
+            return Call(Find(name), std::move(parameters), id);
+        }
+
+        // Faults found before calling the method are returned without
+        // throwing, only those thrown by the method itself are caught
+        Response Invoke(const MethodHandle& handle, Request::Parameters parameters, const Json& id) const {
+            if (handle.myGeneration != myGeneration.load()) {
+                // resolved before the registrations changed
+                return Invoke(handle.myName, std::move(parameters), id);
+            }
+            return Call(handle, std::move(parameters), id);
+        }
+
+        // Calls done with the response once the method completes, which
+        // asynchronous methods may do later and from another thread. Other
+        // methods are invoked like Invoke(request) does, before returning,
+        // unless they wait for their turn under SetMaxConcurrency(): the call
+        // is then posted to its pool, or made by the thread completing the
+        // previous one.
+        void InvokeAsync(Request& request, AsyncResult::Callback done) const {
+            MethodHandle handle = Find(request.GetMethodName());
+            ConcurrencyLimit* limit = GetConcurrencyLimit(handle);
+            if (!handle || (!handle.myMethod->IsAsync() && !limit)) {
+                done(Invoke(request));
+                return;
+            }
+
+            // keyed like Invoke() does, by the parameters of the alias too
+            ResultCache* cache = handle.myMethod->GetResultCache();
+            std::string key;
+            if (cache && !handle.myAlias) {
+                StringRef params = request.GetRawParameters();
+                key = params.empty() ? ResultCache::GetKey(request.GetParameters()) : ResultCache::GetKey(params);
+            }
+
+            Request::Parameters parameters = request.TakeParameters();
+            auto prepared = PrepareCall(handle, parameters);
+            if (!prepared) {
+                Response response(prepared.GetFaultCode(), prepared.GetFaultString(), request.GetId());
+                CallTimer().Record(handle.myMethod->GetStats(), response);
+                done(std::move(response));
+                return;
+            }
+
+            // the call may outlive the request and the arena of its parameters
+            std::shared_ptr<const MethodWrapper> method = handle.myMethod;
+            if (cache) {
+                if (handle.myAlias) {
+                    key = ResultCache::GetKey(parameters);
+                }
+                // answered without taking a turn
+                if (auto result = cache->Find(key)) {
+                    Response response = Response::FromResultText(*result, request.GetId());
+                    CallTimer().Record(method->GetStats(), response);
+                    done(std::move(response));
+                    return;
+                }
+                done = Keep(method, std::move(key), std::move(done));
+            }
+            if (!limit) {
+                CallAsync(*method, parameters, request.GetId(), Measure(method, std::move(done)));
+                return;
+            }
+
+            auto copy = std::make_shared<Request::Parameters>(parameters);
+            Json id = request.GetId();
+            limit->Post([method, copy, id, done]() {
+                CallAsync(*method, *copy, id, Measure(method, [method, done](Response response) {
+                    done(std::move(response));
+                    method->GetConcurrencyLimit()->Release();
+                }));
+            });
+        }
+
+    private:
+        struct IndexEntry {
+            std::shared_ptr<const MethodWrapper> method;
+            std::shared_ptr<const AliasWrapper> alias;
+        };
+
+        // One version of the registrations, never changed once published.
+        // The copies of the wrappers are shared with the next versions.
+        struct Registry {
+            Registry() {}
+
+            // the index points into the copied maps, it is rebuilt
+            Registry(const Registry& other) : methods(other.methods), aliases(other.aliases), generation(other.generation) {}
+
+            std::map<std::string, std::shared_ptr<const MethodWrapper>> methods;
+            std::map<std::string, std::shared_ptr<const AliasWrapper>> aliases;
+            MethodIndex<IndexEntry> index;
+            // of the handles resolved from it
+            uint64_t generation = 1;
+        };
+
+        MethodWrapper& Publish(std::string name, std::shared_ptr<MethodWrapper> method, bool replace) {
+            method->myName = name;
+            method->myDispatcher = mySelf;
+            std::lock_guard<std::mutex> lock(myWriteMutex);
+            auto result = myMethods.emplace(name, method);
+            if (!result.second) {
+                if (!replace) {
+                    throw std::invalid_argument(name + ": method already added");
+                }
+                result.first->second = method;
+            }
+            myChanged.insert(std::move(name));
+            Commit();
+            return *method;
+        }
+
+        // The next version of the registrations, under myWriteMutex
+        Registry& GetPending() {
+            if (!myPending) {
+                myPending.reset(new Registry(myRegistry.GetForWriter()));
+            }
+            return *myPending;
+        }
+
+        // Publishes it with copies of the changed methods, unless a Batch
+        // defers it
+        void Commit() {
+            if (myBatches > 0) {
+                return;
+            }
+            if (!myChanged.empty()) {
+                Registry& registry = GetPending();
+                for (auto& name : myChanged) {
+                    auto found = myMethods.find(name);
+                    if (found != myMethods.end()) {
+                        registry.methods[name] = Copy(*found->second);
                     }
                 }
+                myChanged.clear();
+            }
+            if (myPending) {
+                Publish(std::move(myPending));
+            }
+        }
+
+        void Publish(std::unique_ptr<Registry> registry) {
+            BuildIndex(*registry);
+            const uint64_t generation = ++registry->generation;
+            myRegistry.Publish(std::unique_ptr<const Registry>(std::move(registry)));
+            myGeneration.store(generation);
+        }
 
-                auto method = myMethods.find(name);
-                if (method == myMethods.end()) {
-                    throw MethodNotFoundFault("Method not found: " + name);
+        // The setters of a wrapper already added, see MethodWrapper::Update()
+        void Update(MethodWrapper& method, const std::function<void(MethodWrapper&)>& change) {
+            std::lock_guard<std::mutex> lock(myWriteMutex);
+            auto found = myMethods.find(method.myName);
+            if (found == myMethods.end() || found->second.get() != &method) {
+                throw std::invalid_argument(method.myName + ": method was replaced or removed");
+            }
+            change(method);
+            myChanged.insert(method.myName);
+            Commit();
+        }
+
+        // What the calls run, the setters of the copy do not publish it
+        static std::shared_ptr<const MethodWrapper> Copy(const MethodWrapper& method) {
+            std::shared_ptr<MethodWrapper> copy(new MethodWrapper(method));
+            copy->myDispatcher.reset();
+            return copy;
+        }
+
+        // The read scope only covers the lookup, the handle owns what it found
+        MethodHandle Find(StringRef name) const {
+            RcuPtr<Registry>::ReadScope registry(myRegistry);
+            return Resolve(*registry, name);
+        }
+
+        static MethodHandle Resolve(const Registry& registry, StringRef name) {
+            MethodHandle handle;
+            handle.myGeneration = registry.generation;
+
+            // a single probe finds the method, or the alias and the method it resolves to
+            auto entry = registry.index.Find(name);
+            if (!entry) {
+                // kept for the error message
+                handle.myName = name.str();
+                return handle;
+            }
+            handle.myAlias = entry->alias;
+            if (!entry->method) {
+                return handle;
+            }
+
+            const MethodWrapper& method = *entry->method;
+            handle.myMethod = entry->method;
+            //for backwards-compatible to client wit less parameters
+            if (method.GetLeastOfPara() >= 0 && method.GetLeastOfPara() < method.GetNumberOfPara()) {
+                handle.myLeastOfPara = method.GetLeastOfPara();
+                handle.myNumberOfPara = method.GetNumberOfPara();
+            }
+            return handle;
+        }
+
+        // Records the call in the stats of the method, when there is one
+        template<typename Call>
+        static Response Measure(const MethodHandle& handle, Call call) {
+            if (!handle) {
+                return call();
+            }
+            CallTimer timer;
+            Response response = call();
+            timer.Record(handle.myMethod->GetStats(), response);
+            return response;
+        }
+
+        // Same for an asynchronous call, recorded once it completes
+        static AsyncResult::Callback Measure(std::shared_ptr<const MethodWrapper> method, AsyncResult::Callback done) {
+#ifdef JSONRPC_LEAN_DISABLE_STATS
+            (void)method;
+            return done;
+#else
+            CallTimer timer;
+            return [method, timer, done](Response response) {
+                timer.Record(method->GetStats(), response);
+                done(std::move(response));
+            };
+#endif
+        }
+
+        // Keeps the result of an asynchronous call in the cache of method
+        static AsyncResult::Callback Keep(std::shared_ptr<const MethodWrapper> method, std::string key, AsyncResult::Callback done) {
+            return [method, key, done](Response response) {
+                if (!response.IsFault()) {
+                    method->GetResultCache()->Insert(key, response.GetResultText());
                 }
-                //for backwards-compatible to client wit less parameters
-                if(method->second.GetLeastOfPara() <= parameters.size() && parameters.size() < method->second.GetNumberOfPara()) {
-                    for(int i = parameters.size();i < method->second.GetNumberOfPara(); i++){
-                        parameters.push_back(Json());
+                done(std::move(response));
+            };
+        }
+
+        bool IsSubclass() const {
+#if defined(__GXX_RTTI) || defined(_CPPRTTI)
+            return typeid(*this) != typeid(Dispatcher);
+#else
+            // cannot tell without RTTI
+            return true;
+#endif
+        }
+
+        static ConcurrencyLimit* GetConcurrencyLimit(const MethodHandle& handle) {
+            return handle ? handle.myMethod->GetConcurrencyLimit() : nullptr;
+        }
+
+        // The Invoke() calls of a handle found for them
+        Response Call(const MethodHandle& handle, Request::Parameters parameters, const Json& id) const {
+            ConcurrencyLimit::Slot slot(GetConcurrencyLimit(handle));
+            return Measure(handle, [&]() { return Call(handle, std::move(parameters), id, false); });
+        }
+
+        // Once the method may run
+        Response Call(const MethodHandle& handle, Request& request) const {
+            ResultCache* cache = handle ? handle.myMethod->GetResultCache() : nullptr;
+            if (!cache) {
+                return CallTyped(handle, request);
+            }
+            if (handle.myAlias) {
+                // keyed by the parameters of the alias too
+                return Call(handle, request.TakeParameters(), request.GetId(), true);
+            }
+            StringRef params = request.GetRawParameters();
+            std::string key = params.empty() ? ResultCache::GetKey(request.GetParameters()) : ResultCache::GetKey(params);
+            return Cached(*cache, std::move(key), request.GetId(), [&]() { return CallTyped(handle, request); });
+        }
+
+        Response CallTyped(const MethodHandle& handle, Request& request) const {
+            StringRef params = request.GetRawParameters();
+            if (!params.empty()) {
+                if (handle && !handle.myAlias && handle.myMethod->HasTypedMethod()) {
+                    std::string result;
+                    bool called = false;
+                    Response response = Guard(request.GetId(), [&]() -> Response {
+                        called = (*handle.myMethod)(params, result);
+                        return Response::FromResultText(std::move(result), Json(request.GetId()));
+                    });
+                    if (called || response.IsFault()) {
+                        return response;
                     }
                 }
+            }
+            auto parameters = request.TakeParameters();
+            auto prepared = PrepareCall(handle, parameters);
+            if (!prepared) {
+                return Response(prepared.GetFaultCode(), prepared.GetFaultString(), Json(request.GetId()));
+            }
+            return Call(*handle.myMethod, parameters, request.GetId(), true);
+        }
+
+        Response Call(const MethodHandle& handle, Request::Parameters parameters, const Json& id, bool serialized) const {
+            auto prepared = PrepareCall(handle, parameters);
+            if (!prepared) {
+                return Response(prepared.GetFaultCode(), prepared.GetFaultString(), Json(id));
+            }
+            const MethodWrapper& method = *handle.myMethod;
+            if (ResultCache* cache = method.GetResultCache()) {
+                return Cached(*cache, ResultCache::GetKey(parameters), id, [&]() { return Call(method, parameters, id, serialized); });
+            }
+            return Call(method, parameters, id, serialized);
+        }
+
+        // Answers from cache, or calls and keeps the result
+        template<typename Call>
+        static Response Cached(ResultCache& cache, std::string key, const Json& id, Call call) {
+            if (auto result = cache.Find(key)) {
+                return Response::FromResultText(*result, Json(id));
+            }
+            Response response = call();
+            if (!response.IsFault()) {
+                cache.Insert(std::move(key), response.GetResultText());
+            }
+            return response;
+        }
+
+        // The parameters are prepared already. The result is only written
+        // as text for the responses of Server, which writes them out; the
+        // callers of Invoke(name, parameters, id) get its Json.
+        static Response Call(const MethodWrapper& method, const Request::Parameters& parameters, const Json& id, bool serialized) {
+            return Guard(id, [&]() -> Response {
+                if (serialized && method.HasSerializedMethod()) {
+                    std::string result;
+                    method(parameters, result);
+                    return Response::FromResultText(std::move(result), Json(id));
+                }
+                return{ method(parameters), Json(id) };
+            });
+        }
+
+        static void CallAsync(const MethodWrapper& method, const Request::Parameters& parameters, const Json& id, AsyncResult::Callback done) {
+            if (!method.IsAsync()) {
+                done(Call(method, parameters, id, true));
+                return;
+            }
+
+            AsyncResult result(std::move(done), id);
+            Response thrown = Guard(id, [&]() -> Response {
+                method(parameters, result);
+                return Response(Json(), Json());
+            });
+            if (thrown.IsFault()) {
+                result.Complete(thrown.GetFaultCode(), thrown.GetFaultString());
+            }
+        }
 
-                return{ method->second(parameters), Json(id) };
+        // Applies the alias parameters and the padding of the handle
+        static Expected<void> PrepareCall(const MethodHandle& handle, Request::Parameters& parameters) {
+            if (!handle) {
+                return MethodNotFoundFault("Method not found: " + handle.GetName());
+            }
+            if (handle.myAlias) {
+                // concatenate parameters, appending the call ones after the alias ones
+                const Request::Parameters& prefix = handle.myAlias->parameters;
+                Request::Parameters all(parameters.get_allocator());
+                all.reserve(prefix.size() + parameters.size());
+                all.insert(all.end(), prefix.begin(), prefix.end());
+                all.insert(all.end(), std::make_move_iterator(parameters.begin()), std::make_move_iterator(parameters.end()));
+                parameters = std::move(all);
+            }
+            if (handle.myLeastOfPara <= parameters.size() && parameters.size() < handle.myNumberOfPara) {
+                parameters.resize(handle.myNumberOfPara);
+            }
+            if (parameters.size() < handle.myMethod->GetRequiredParameters()) {
+                return TooFewParameters();
+            }
+            return{};
+        }
+
+        // Runs call, turning the exceptions it throws into fault responses
+        template<typename Call>
+        static Response Guard(const Json& id, Call call) {
+            try {
+                return call();
             }
             catch (const Fault& fault) {
-                return Response(fault.GetCode(), fault.GetString(), Json(id));
+                return Response(fault, Json(id));
             }
             catch (const std::out_of_range&) {
-                InvalidParametersFault fault;
-                return Response(fault.GetCode(), fault.GetString(), Json(id));
+                return Response(InvalidParametersFault(), Json(id));
             }
             catch (const std::invalid_argument& ex){
-                InvalidParametersFault fault;
-                return Response(fault.GetCode(), fault.GetString(), Json(id));
+                return Response(InvalidParametersFault(), Json(id));
             }
             catch (const std::exception& ex) {
-                ServerErrorFault fault(Fault::SERVER_ERROR_CODE_DEFAULT, ex.what());
-                return Response(fault.GetCode(), fault.GetString(), Json(id));
+                return Response(ServerErrorFault(Fault::SERVER_ERROR_CODE_DEFAULT, ex.what()), Json(id));
             }
             catch (...) {
                 return Response(0, "unknown error", Json(id));
             }
         }
 
-    private:
+        static void BuildIndex(Registry& registry) {
+            registry.index.Reset(registry.methods.size() + registry.aliases.size());
+            for (auto& method : registry.methods) {
+                registry.index.Insert(method.first, IndexEntry{ method.second, nullptr });
+            }
+            // aliases take precedence over methods of the same name
+            for (auto& alias : registry.aliases) {
+                auto method = registry.methods.find(alias.second->name);
+                registry.index.Insert(alias.first, IndexEntry{ method == registry.methods.end() ? nullptr : method->second,
+                    alias.second });
+            }
+        }
+
         template<typename ReturnType, typename... ParameterTypes>
-        MethodWrapper& AddMethodInternal(std::string name, std::function<ReturnType(ParameterTypes...)> method) {
-            return AddMethodInternal(std::move(name), std::move(method), redi::index_sequence_for < ParameterTypes... > {});
+        static std::shared_ptr<MethodWrapper> MakeMethod(std::function<ReturnType(ParameterTypes...)> method) {
+            return MakeMethod(std::move(method), redi::index_sequence_for < ParameterTypes... > {});
         }
 
         template<typename... ParameterTypes>
-        MethodWrapper& AddMethodInternal(std::string name, std::function<void(ParameterTypes...)> method) {
+        static std::shared_ptr<MethodWrapper> MakeMethod(std::function<void(ParameterTypes...)> method) {
             std::function<Json(ParameterTypes...)> returnMethod = [method](ParameterTypes&&... params) -> Json {
                 method(std::forward<ParameterTypes>(params)...);
                 return Json();
             };
-            return AddMethodInternal(std::move(name), std::move(returnMethod), redi::index_sequence_for < ParameterTypes... > {});
+            return MakeMethod(std::move(returnMethod), redi::index_sequence_for < ParameterTypes... > {});
         }
 
         template<typename ReturnType, typename... ParameterTypes, std::size_t... index>
-        MethodWrapper& AddMethodInternal(std::string name, std::function<ReturnType(ParameterTypes...)> method, redi::index_sequence<index...>) {
+        // Completely set up before it is published
+        static std::shared_ptr<MethodWrapper> MakeMethod(std::function<ReturnType(ParameterTypes...)> method, redi::index_sequence<index...>) {
             MethodWrapper::Method realMethod = [method](const Request::Parameters& params) -> Json {
-                if (params.size() < sizeof...(ParameterTypes)) { //ex: client 3 parameters -> rpc server 4 parameters, without SetLeastOfPara(3).SetNumberOfPara(4) will throw
-                    throw InvalidParametersFault("Invalid parameters, less than required least number");
-                } else if(sizeof...(ParameterTypes) < params.size()) { //ex: client 4 parameters -> rpc server 3 parameters
-                    ///@todo warning in info
-                }
-                return method(params[index].AsType<typename std::decay<ParameterTypes>::type>()...);
+                CheckNumberOfParameters(params, sizeof...(ParameterTypes));
+                return method(ParameterFromJson<typename std::decay<ParameterTypes>::type>::Get(params[index])...);
             };
-            return AddMethod(std::move(name), std::move(realMethod));
+            auto shared = std::make_shared<MethodWrapper>(std::move(realMethod));
+            MethodWrapper& wrapper = *shared;
+            wrapper.SetRequiredParameters(sizeof...(ParameterTypes));
+            wrapper.SetSerializedMethod([method](const Request::Parameters& params, std::string& result) {
+                CheckNumberOfParameters(params, sizeof...(ParameterTypes));
+                JsonWriter writer(result);
+                ResultWriter<typename std::decay<ReturnType>::type>::Write(writer,
+                    method(ParameterFromJson<typename std::decay<ParameterTypes>::type>::Get(params[index])...));
+            });
+            AddTypedMethod(wrapper, method, AllDecodable<typename std::decay<ParameterTypes>::type...>{}, redi::index_sequence<index...>{});
+            return shared;
         }
 
+        static InvalidParametersFault TooFewParameters() {
+            return InvalidParametersFault("Invalid parameters, less than required least number");
+        }
 
-        AliasWrapper AddAliasInternal(std::string method){
-          Request::Parameters params {};
-          AliasWrapper alias {method, params};
-          return std::move(alias);
+        // Invoke() checks it first, this is for calls through GetMethod()
+        static void CheckNumberOfParameters(const Request::Parameters& params, size_t required) {
+            if (params.size() < required) { //ex: client 3 parameters -> rpc server 4 parameters, without SetLeastOfPara(3).SetNumberOfPara(4) will throw
+                throw TooFewParameters();
+            } else if(required < params.size()) { //ex: client 4 parameters -> rpc server 3 parameters
+                ///@todo warning in info
+            }
         }
 
+        template<typename ReturnType, typename... ParameterTypes, std::size_t... index>
+        static void AddTypedMethod(MethodWrapper& wrapper, std::function<ReturnType(ParameterTypes...)> method, std::true_type, redi::index_sequence<index...>) {
+            wrapper.SetTypedMethod([method](StringRef params, std::string& result) -> bool {
+                std::tuple<typename std::decay<ParameterTypes>::type...> values;
+                if (!DecodeParameters(params, values, redi::index_sequence<index...>{})) {
+                    return false;
+                }
+                JsonWriter writer(result);
+                ResultWriter<typename std::decay<ReturnType>::type>::Write(writer, method(std::move(std::get<index>(values))...));
+                return true;
+            });
+        }
 
-        template<typename FirstType, typename... ParameterTypes>
-        AliasWrapper AddAliasInternal(std::string method, FirstType f, ParameterTypes... p){
-          AliasWrapper alias = AddAliasInternal(method, p...);
-          alias.parameters.push_front(f);
-          return std::move(alias);
+        // some parameter type has no decoder, the method always goes through Json
+        template<typename ReturnType, typename... ParameterTypes, std::size_t... index>
+        static void AddTypedMethod(MethodWrapper&, std::function<ReturnType(ParameterTypes...)>, std::false_type, redi::index_sequence<index...>) {
         }
 
 
-    protected:
-        std::map<std::string, MethodWrapper> myMethods;
-        std::map<std::string, AliasWrapper> myAliases;
+        template<typename... ParameterTypes>
+        AliasWrapper AddAliasInternal(std::string method, ParameterTypes... parameters){
+          return AliasWrapper{ std::move(method), Request::Parameters{ Json(parameters)... } };
+        }
+
+
+        RcuPtr<Registry> myRegistry;
+        // that of the current registrations
+        std::atomic<uint64_t> myGeneration;
+        std::mutex myWriteMutex;
+        // the changes not published yet, and the batches deferring them
+        std::unique_ptr<Registry> myPending;
+        size_t myBatches;
+        // the wrappers returned to the callers, and those changed since the
+        // last publication
+        std::map<std::string, std::shared_ptr<MethodWrapper>> myMethods;
+        std::set<std::string> myChanged;
+        // what the added wrappers refer to, expires with the Dispatcher
+        std::shared_ptr<Dispatcher*> mySelf;
+
+        friend class MethodWrapper;
     };
 
+    inline MethodWrapper& MethodWrapper::Update(const std::function<void(MethodWrapper&)>& change) {
+        if (std::shared_ptr<Dispatcher*> dispatcher = myDispatcher.lock()) {
+            (*dispatcher)->Update(*this, change);
+        } else {
+            change(*this);
+        }
+        return *this;
+    }
+
 } // namespace jsonrpc
 
 #endif // JSONRPC_LEAN_DISPATCHER_H
@@ -0,0 +1,69 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_EXECUTOR_H
+#define JSONRPC_LEAN_EXECUTOR_H
+
+#include "server.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace jsonrpc {
+
+    // Handles the requests of one Server on a pool of worker threads: the
+    // request text is parsed and dispatched by a worker, and its response
+    // handed to the completion callback as Server::HandleRequestAsync does.
+    // All methods must be safe to call concurrently.
+    class Executor {
+    public:
+        typedef std::function<void(std::string response)> Callback;
+
+        // With no threads, requests are handled by the thread submitting them.
+        // The destructor waits for the submitted requests to be dispatched,
+        // asynchronous methods may still complete them afterwards.
+        explicit Executor(Server& server, size_t threads = GetDefaultThreads())
+            : myServer(server), myPool(threads) {
+        }
+
+        // One per hardware thread, at least one when it is not known
+        static size_t GetDefaultThreads() {
+            return std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+
+        Executor(const Executor&) = delete;
+        Executor& operator=(const Executor&) = delete;
+
+        // Returns right away, done is called on a worker thread, or on the
+        // one completing an asynchronous method
+        void Submit(std::string request, Callback done) {
+            myPool.Post(Task{ &myServer, std::move(request), std::move(done) });
+        }
+
+        Server& GetServer() { return myServer; }
+
+        // Methods can post their own work here, it is run by the same workers
+        ThreadPool& GetPool() { return myPool; }
+
+    private:
+        struct Task {
+            void operator()() {
+                server->HandleRequestAsync(request, std::move(done));
+            }
+
+            Server* server;
+            std::string request;
+            Callback done;
+        };
+
+        Server& myServer;
+        ThreadPool myPool;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_EXECUTOR_H
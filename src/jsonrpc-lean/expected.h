@@ -0,0 +1,122 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_EXPECTED_H
+#define JSONRPC_LEAN_EXPECTED_H
+
+#include "fault.h"
+
+#include <cstdint>
+#include <new>
+#include <string>
+#include <utility>
+
+namespace jsonrpc {
+
+    // Either a value or the fault that prevented it, so that the request path
+    // reports invalid input without throwing. A fault is given as the Fault
+    // object that would otherwise have been thrown, e.g.
+    // `return InvalidRequestFault();`.
+    template<typename T>
+    class Expected {
+    public:
+        Expected(T value) : myHasValue(true), myFaultCode(0) {
+            ::new (static_cast<void*>(&myValue)) T(std::move(value));
+        }
+
+        Expected(const Fault& fault)
+            : myHasValue(false),
+            myFaultCode(fault.GetCode()),
+            myFaultString(fault.GetString()) {
+        }
+
+        Expected(const Expected& other)
+            : myHasValue(other.myHasValue),
+            myFaultCode(other.myFaultCode),
+            myFaultString(other.myFaultString) {
+            if (myHasValue) {
+                ::new (static_cast<void*>(&myValue)) T(other.myValue);
+            }
+        }
+
+        Expected(Expected&& other)
+            : myHasValue(other.myHasValue),
+            myFaultCode(other.myFaultCode),
+            myFaultString(std::move(other.myFaultString)) {
+            if (myHasValue) {
+                ::new (static_cast<void*>(&myValue)) T(std::move(other.myValue));
+            }
+        }
+
+        Expected& operator=(const Expected&) = delete;
+
+        ~Expected() {
+            if (myHasValue) {
+                myValue.~T();
+            }
+        }
+
+        explicit operator bool() const { return myHasValue; }
+
+        // Only valid when there is a value
+        T& operator*() { return myValue; }
+        const T& operator*() const { return myValue; }
+        T* operator->() { return &myValue; }
+        const T* operator->() const { return &myValue; }
+
+        // The value, or throws the fault
+        T& GetValue() {
+            ThrowIfFault();
+            return myValue;
+        }
+
+        int32_t GetFaultCode() const { return myFaultCode; }
+        const std::string& GetFaultString() const { return myFaultString; }
+
+        void ThrowIfFault() const {
+            if (!myHasValue) {
+                Fault::Throw(myFaultCode, myFaultString);
+            }
+        }
+
+    private:
+        bool myHasValue;
+        union {
+            T myValue;
+        };
+        int32_t myFaultCode;
+        std::string myFaultString;
+    };
+
+    // Success, or the fault of an operation that has no value
+    template<>
+    class Expected<void> {
+    public:
+        Expected() : myHasValue(true), myFaultCode(0) {}
+
+        Expected(const Fault& fault)
+            : myHasValue(false),
+            myFaultCode(fault.GetCode()),
+            myFaultString(fault.GetString()) {
+        }
+
+        explicit operator bool() const { return myHasValue; }
+
+        int32_t GetFaultCode() const { return myFaultCode; }
+        const std::string& GetFaultString() const { return myFaultString; }
+
+        void ThrowIfFault() const {
+            if (!myHasValue) {
+                Fault::Throw(myFaultCode, myFaultString);
+            }
+        }
+
+    private:
+        bool myHasValue;
+        int32_t myFaultCode;
+        std::string myFaultString;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_EXPECTED_H
@@ -42,6 +42,9 @@ namespace jsonrpc {
         int32_t GetCode() const { return myFaultCode; }
         const std::string& GetString() const { return myFaultString; }
 
+        // Throws the fault class matching faultCode
+        [[noreturn]] static void Throw(int32_t faultCode, std::string faultString);
+
         const char* what() const noexcept override
         {
             return myFaultString.c_str();
@@ -65,7 +68,7 @@ namespace jsonrpc {
             : Fault(faultCode, std::move(faultString)) {
         }
 
-        friend class Response;
+        friend class Fault;
     };
 
     class ParseErrorFault : public PreDefinedFault {
@@ -111,6 +114,38 @@ namespace jsonrpc {
         }
     };
 
+    inline void Fault::Throw(int32_t faultCode, std::string faultString) {
+        switch (static_cast<Fault::ReservedCodes>(faultCode)) {
+        case Fault::RESERVED_CODE_MIN:
+        case Fault::RESERVED_CODE_MAX:
+        case Fault::SERVER_ERROR_CODE_MIN:
+        case Fault::SERVER_ERROR_CODE_DEFAULT:
+            break;
+        case Fault::PARSE_ERROR:
+            throw ParseErrorFault(std::move(faultString));
+        case Fault::INVALID_REQUEST:
+            throw InvalidRequestFault(std::move(faultString));
+        case Fault::METHOD_NOT_FOUND:
+            throw MethodNotFoundFault(std::move(faultString));
+        case Fault::INVALID_PARAMETERS:
+            throw InvalidParametersFault(std::move(faultString));
+        case Fault::INTERNAL_ERROR:
+            throw InternalErrorFault(std::move(faultString));
+        }
+
+        if (faultCode >= Fault::SERVER_ERROR_CODE_MIN
+            && faultCode <= Fault::SERVER_ERROR_CODE_MAX) {
+            throw ServerErrorFault(faultCode, std::move(faultString));
+        }
+
+        if (faultCode >= Fault::RESERVED_CODE_MIN
+            && faultCode <= Fault::RESERVED_CODE_MAX) {
+            throw PreDefinedFault(faultCode, std::move(faultString));
+        }
+
+        throw Fault(std::move(faultString), faultCode);
+    }
+
 } // namespace jsonrpc
 
 #endif //JSONRPC_LEAN_FAULT_H
@@ -0,0 +1,336 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_FRAMING_H
+#define JSONRPC_LEAN_FRAMING_H
+
+#include "jsonscanner.h"
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <string>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace jsonrpc {
+
+    // How messages are delimited on a stream: one per line (NDJSON), or as
+    // netstrings, "<length>:<message>,"
+    enum class Framing {
+        NEWLINE_DELIMITED,
+        NETSTRING
+    };
+
+    // Cuts the messages out of a framed stream pushed in chunks of any
+    // size. Like StreamParser, messages within a chunk are handed over
+    // straight from it and only one cut by the end of a chunk is copied.
+    class FrameReader {
+    public:
+        // 0 for no limit on the size of a message
+        explicit FrameReader(Framing framing, size_t maxMessageSize = 0)
+            : myFraming(framing), myMaxMessageSize(maxMessageSize) {
+            Reset();
+        }
+
+        // Calls onMessage(StringRef message) for each message completed by
+        // data, which is only valid during the call. Returns false on
+        // invalid framing or a message over the size limit, the reader must
+        // then be Reset().
+        template<typename Callback>
+        bool Feed(const char* data, size_t size, Callback&& onMessage) {
+            if (myFailed) {
+                return false;
+            }
+            if (myFraming == Framing::NEWLINE_DELIMITED) {
+                return FeedLines(data, data + size, onMessage);
+            }
+            return FeedNetstrings(data, data + size, onMessage);
+        }
+
+        void Reset() {
+            myBuffer.clear();
+            myInPayload = false;
+            myLength = 0;
+            myLengthDigits = 0;
+            myFailed = false;
+        }
+
+        // False while a message is only partly received
+        bool IsIdle() const { return myBuffer.empty() && myLengthDigits == 0 && !myFailed; }
+
+    private:
+        // Empty lines are skipped, and so is the \r of \r\n
+        template<typename Callback>
+        bool FeedLines(const char* p, const char* end, Callback& onMessage) {
+            while (p != end) {
+                const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+                if (!newline) {
+                    return Append(p, end);
+                }
+
+                StringRef line(p, newline);
+                if (!myBuffer.empty()) {
+                    if (!Append(p, newline)) {
+                        return false;
+                    }
+                    line = StringRef(myBuffer);
+                } else if (!CheckSize(line.size())) {
+                    return false;
+                }
+                if (!line.empty() && line[line.size() - 1] == '\r') {
+                    line = StringRef(line.data(), line.size() - 1);
+                }
+                if (!line.empty()) {
+                    onMessage(line);
+                }
+                myBuffer.clear();
+                p = newline + 1;
+            }
+            return true;
+        }
+
+        template<typename Callback>
+        bool FeedNetstrings(const char* p, const char* end, Callback& onMessage) {
+            while (p != end) {
+                if (!myInPayload) {
+                    const char ch = *p++;
+                    if (ch >= '0' && ch <= '9') {
+                        myLength = myLength * 10 + (ch - '0');
+                        if (++myLengthDigits > 18 || !CheckSize(myLength)) {
+                            return Fail();
+                        }
+                    } else if (ch == ':' && myLengthDigits > 0) {
+                        myInPayload = true;
+                    } else {
+                        return Fail();
+                    }
+                    continue;
+                }
+
+                if (myBuffer.size() < myLength) {
+                    const size_t available = end - p;
+                    if (myBuffer.empty() && available > myLength) {
+                        // the whole message and its comma are in this chunk
+                        if (p[myLength] != ',') {
+                            return Fail();
+                        }
+                        onMessage(StringRef(p, myLength));
+                        p += myLength + 1;
+                        NextNetstring();
+                        continue;
+                    }
+                    const size_t take = std::min(myLength - myBuffer.size(), available);
+                    myBuffer.append(p, take);
+                    p += take;
+                    continue;
+                }
+
+                // the message is buffered, the comma is all that is left
+                if (*p++ != ',') {
+                    return Fail();
+                }
+                onMessage(StringRef(myBuffer));
+                NextNetstring();
+            }
+            return true;
+        }
+
+        void NextNetstring() {
+            myBuffer.clear();
+            myInPayload = false;
+            myLength = 0;
+            myLengthDigits = 0;
+        }
+
+        bool Append(const char* begin, const char* end) {
+            if (!CheckSize(myBuffer.size() + (end - begin))) {
+                return false;
+            }
+            myBuffer.append(begin, end - begin);
+            return true;
+        }
+
+        bool CheckSize(size_t size) {
+            if (myMaxMessageSize != 0 && size > myMaxMessageSize) {
+                return Fail();
+            }
+            return true;
+        }
+
+        bool Fail() {
+            myFailed = true;
+            myBuffer.clear();
+            return false;
+        }
+
+        Framing myFraming;
+        size_t myMaxMessageSize;
+        std::string myBuffer;
+        bool myInPayload;
+        size_t myLength;
+        size_t myLengthDigits;
+        bool myFailed;
+    };
+
+    // Queues framed messages and writes as many of them as a descriptor
+    // takes with a single writev, without copying them into one buffer.
+    // Sockets are written with sendmsg instead, so that a closed peer is an
+    // EPIPE error rather than a SIGPIPE.
+    class FrameWriter {
+    public:
+        explicit FrameWriter(Framing framing) : myFraming(framing), myOffset(0), myPendingSize(0), myIsSocket(true) {}
+
+        // An empty message, the response to a notification, is not written
+        void Add(std::string message) {
+            if (message.empty()) {
+                return;
+            }
+            myPendingSize += message.size();
+            if (myFraming == Framing::NEWLINE_DELIMITED) {
+                myPieces.push_back(std::move(message));
+                myPieces.push_back("\n");
+                myPendingSize += 1;
+                return;
+            }
+            std::string head = std::to_string(message.size());
+            head += ':';
+            myPendingSize += head.size() + 1;
+            myPieces.push_back(std::move(head));
+            myPieces.push_back(std::move(message));
+            myPieces.push_back(",");
+        }
+
+        bool IsEmpty() const { return myPieces.empty(); }
+        size_t GetPendingSize() const { return myPendingSize; }
+
+        // Returns false on a write error. What a non-blocking descriptor did
+        // not take yet stays queued, check IsEmpty().
+        bool WriteTo(int fd) {
+            while (!myPieces.empty()) {
+                struct iovec vectors[64];
+                const size_t count = std::min(myPieces.size(), sizeof(vectors) / sizeof(vectors[0]));
+                for (size_t i = 0; i < count; ++i) {
+                    const size_t offset = i == 0 ? myOffset : 0;
+                    vectors[i].iov_base = const_cast<char*>(myPieces[i].data() + offset);
+                    vectors[i].iov_len = myPieces[i].size() - offset;
+                }
+
+                ssize_t written;
+                if (myIsSocket) {
+                    struct msghdr message;
+                    memset(&message, 0, sizeof(message));
+                    message.msg_iov = vectors;
+                    message.msg_iovlen = count;
+                    written = sendmsg(fd, &message, MSG_NOSIGNAL);
+                } else {
+                    written = writev(fd, vectors, static_cast<int>(count));
+                }
+                if (written < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    if (errno == ENOTSOCK && myIsSocket) {
+                        myIsSocket = false;
+                        continue;
+                    }
+                    return errno == EAGAIN || errno == EWOULDBLOCK;
+                }
+                Consume(static_cast<size_t>(written));
+            }
+            return true;
+        }
+
+    private:
+        void Consume(size_t size) {
+            myPendingSize -= size;
+            while (size > 0) {
+                const size_t left = myPieces.front().size() - myOffset;
+                if (size < left) {
+                    myOffset += size;
+                    return;
+                }
+                size -= left;
+                myPieces.pop_front();
+                myOffset = 0;
+            }
+        }
+
+        Framing myFraming;
+        std::deque<std::string> myPieces;
+        size_t myOffset;
+        size_t myPendingSize;
+        bool myIsSocket;
+    };
+
+    // Serves a Server over a framed stream on a descriptor: a socket, a
+    // pipe or anything else read() and writev() work on. The requests
+    // completed by each read are handled in order, and their responses are
+    // written together.
+    class FramedConnection {
+    public:
+        FramedConnection(Server& server, int fd, Framing framing, size_t maxMessageSize = 0)
+            : myServer(server), myFd(fd), myOutputFd(fd), myReader(framing, maxMessageSize), myWriter(framing) {
+        }
+
+        // Responses go to outputFd, e.g. the write end of another pipe
+        FramedConnection(Server& server, int inputFd, int outputFd, Framing framing, size_t maxMessageSize = 0)
+            : myServer(server), myFd(inputFd), myOutputFd(outputFd), myReader(framing, maxMessageSize), myWriter(framing) {
+        }
+
+        // Reads once, then answers what was read. Returns false once the
+        // stream ended, on an I/O error or on invalid framing.
+        bool Process() {
+            char buffer[65536];
+            ssize_t size;
+            do {
+                size = read(myFd, buffer, sizeof(buffer));
+            } while (size < 0 && errno == EINTR);
+            if (size <= 0) {
+                return false;
+            }
+
+            const bool framed = myReader.Feed(buffer, static_cast<size_t>(size), [this](StringRef message) {
+                std::string response;
+                myServer.HandleRequest(message, response);
+                myWriter.Add(std::move(response));
+            });
+            // the requests read before the framing error are still answered
+            return Flush() && framed;
+        }
+
+        // Handles requests until the stream ends
+        void Run() {
+            while (Process()) {
+            }
+        }
+
+        // Waits until all the responses are written, when the descriptor is
+        // non-blocking
+        bool Flush() {
+            while (myWriter.WriteTo(myOutputFd)) {
+                if (myWriter.IsEmpty()) {
+                    return true;
+                }
+                struct pollfd writable = { myOutputFd, POLLOUT, 0 };
+                poll(&writable, 1, -1);
+            }
+            return false;
+        }
+
+    private:
+        Server& myServer;
+        int myFd;
+        int myOutputFd;
+        FrameReader myReader;
+        FrameWriter myWriter;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_FRAMING_H
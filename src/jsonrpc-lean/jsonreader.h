@@ -20,13 +20,19 @@
 #ifndef JSONRPC_LEAN_JSONREADER_H
 #define JSONRPC_LEAN_JSONREADER_H
 
+#include "expected.h"
 #include "fault.h"
 #include "json.h"
+#include "jsonscanner.h"
 #include "request.h"
 #include "response.h"
 #include "util.h"
+#include <cstdlib>
+#include <cstring>
+#include <memory>
 #include <utility>
 #include <string>
+#include <vector>
 
 #define RAPIDJSON_NO_SIZETYPEDEFINE
 namespace rapidjson {
@@ -35,64 +41,114 @@ typedef ::std::size_t SizeType;
 
 namespace jsonrpc {
 
+// Requests are read with a single JsonScanner pass over the input that only
+// records where the envelope members are; params are parsed by the Request
+// when they are asked for. Responses still go through the json11 document.
+// The constructors keep a copy of the text, shared with the readers and the
+// requests they return, which may outlive them. The Read functions refer to
+// the caller's text instead, which must outlive the reader and what it
+// returns.
+// The Read functions report invalid input as an Expected fault, the others
+// throw it.
 class JsonReader {
  public:
-  JsonReader(const std::string& data) {
+  JsonReader(std::string data)
+      : myData(std::make_shared<const std::string>(std::move(data))),
+        myBuffer(myData->data()), mySize(myData->size()) {
+    if (!Scan()) {
+      throw ParseErrorFault(GetParseError());
+    }
+  }
 
-    std::string err;
-    myDocument = Json::parse(data, err);
+  explicit JsonReader(Json document) : JsonReader(document.dump()) {
+  }
 
-    if (!err.empty()) {
-      throw ParseErrorFault("Parse error: " + err);
-    }
+  static Expected<JsonReader> Read(const std::string& data) {
+    return Read(StringRef(data));
   }
 
-  // Reader
-  Request GetRequest() {
-    if (!myDocument.is_object()) {
-      throw InvalidRequestFault();
+  // The reader would refer to a temporary, construct one to keep it
+  static Expected<JsonReader> Read(std::string&& data) = delete;
+
+  // data must outlive the reader and what it returns
+  static Expected<JsonReader> Read(StringRef data) {
+    JsonReader reader(data.data(), data.size());
+    if (!reader.Scan()) {
+      return ParseErrorFault(reader.GetParseError());
     }
+    return Expected<JsonReader>(std::move(reader));
+  }
 
-    ValidateJsonrpcVersion();
+  // Batch
+  bool IsBatch() const {
+    return myIsBatch;
+  }
 
-    auto method = myDocument[json::METHOD_NAME];
-    if (method == Json() || !method.is_string()) {
-      throw InvalidRequestFault();
+  // The returned readers share the text of this one
+  std::vector<JsonReader> GetBatch() const {
+    return std::move(ReadBatch().GetValue());
+  }
+
+  Expected<std::vector<JsonReader>> ReadBatch() const {
+    if (!IsBatch() || myBatch.empty()) {
+      return InvalidRequestFault();
     }
 
-    Request::Parameters parameters;
-    auto params = myDocument[json::PARAMS_NAME];
-    if (params != Json()) {
-      if (!params.is_array()) {
-        throw InvalidRequestFault();
-      }
+    std::vector<JsonReader> batch;
+    batch.reserve(myBatch.size());
+    for (auto& envelope : myBatch) {
+      batch.push_back(JsonReader(Data(), envelope));
+      batch.back().myData = myData;
+    }
+    return batch;
+  }
 
-      for (auto& param : params.array_items()) {
-        parameters.push_back(param);
+  // Reader
+  Request GetRequest() {
+    return std::move(ReadRequest().GetValue());
+  }
+
+  Expected<Request> ReadRequest() {
+    if (!myEnvelope.isObject || !HasJsonrpcVersion() || !IsString(myEnvelope.method)) {
+      return InvalidRequestFault();
+    }
+    std::string method = GetString(myEnvelope.method);
+
+    StringRef params;
+    if (!IsNull(myEnvelope.params)) {
+      params = GetText(myEnvelope.params);
+      if (params[0] != '[') {
+        return InvalidRequestFault();
       }
     }
 
-    auto id = myDocument[json::ID_NAME];
-    if (id == Json()) {
+    if (IsNull(myEnvelope.id)) {
       // Notification
-      return Request(method.string_value(), std::move(parameters), false);
+      return Request(std::move(method), params, false, myData);
     }
 
-    return Request(method.string_value(), std::move(parameters), CheckId(id));
+    auto id = ReadId(myEnvelope.id);
+    if (!id) {
+      return InvalidRequestFault();
+    }
+    return Request(std::move(method), params, std::move(*id), myData);
   }
 
   Response GetResponse() {
-    if (!myDocument.is_object()) {
+    const Json& document = GetJson();
+    if (!document.is_object()) {
       throw InvalidRequestFault();
     }
 
-    ValidateJsonrpcVersion();
+    if (!HasJsonrpcVersion()) {
+      throw InvalidRequestFault();
+    }
 
-    auto id = myDocument[json::ID_NAME];
+    auto id = document[json::ID_NAME];
     id = CheckId(id);
 
-    auto result = myDocument[json::RESULT_NAME];
-    auto error = myDocument[json::ERROR_NAME];
+    auto result = document[json::RESULT_NAME];
+    auto error = document[json::ERROR_NAME];
 
     if (result != Json()) {
       if (error != Json()) {
@@ -125,17 +181,197 @@ class JsonReader {
     }
   }
 
-  Json GetJson() {
+  // Unlike GetResponse(), the result is kept as JSON text until it is asked
+  // for, a null result is valid and the fault data is optional
+  Expected<Response> ReadResponse() const {
+    if (!myEnvelope.isObject || !HasJsonrpcVersion()) {
+      return InvalidRequestFault();
+    }
+    const bool hasResult = myEnvelope.result.size != 0;
+    const bool hasError = myEnvelope.error.size != 0;
+    if (hasResult == hasError) {
+      return InvalidRequestFault();
+    }
+
+    Json id;
+    if (!IsNull(myEnvelope.id)) {
+      auto read = ReadId(myEnvelope.id);
+      if (!read) {
+        return InvalidRequestFault();
+      }
+      id = std::move(*read);
+    }
+
+    if (hasResult) {
+      return Response::FromResultText(GetText(myEnvelope.result).str(), std::move(id));
+    }
+
+    // only the error is parsed
+    std::string err;
+    Json error = Json::parse(GetText(myEnvelope.error).str(), err);
+    const Json& code = error[json::ERROR_CODE_NAME];
+    const Json& message = error[json::ERROR_MESSAGE_NAME];
+    if (!error.is_object() || !code.is_number() || !message.is_string()) {
+      return InvalidRequestFault();
+    }
+    const Json& data = error[json::ERROR_DATA_NAME];
+    return Response(static_cast<int32_t>(code.number_value()), message.string_value(),
+                    data.is_string() ? data.string_value() : std::string(), std::move(id));
+  }
+
+  const Json& GetJson() {
+    if (!myHasDocument) {
+      std::string err;
+      StringRef text = GetText(myEnvelope.text);
+      myDocument = Json::parse(text.str(), err);
+      myHasDocument = true;
+    }
     return myDocument;
   }
 
  private:
-  void ValidateJsonrpcVersion() const {
-    auto jsonrpc = myDocument[json::JSONRPC_NAME];
-    if (jsonrpc == Json() || !jsonrpc.is_string()
-        || jsonrpc.string_value() != json::JSONRPC_VERSION_2_0) {
-      throw InvalidRequestFault();
+  // Where a member value is, relative to the start of the buffer
+  struct Span {
+    size_t offset = 0;
+    size_t size = 0;
+  };
+
+  struct Envelope {
+    Span text;
+    bool isObject = false;
+    Span jsonrpc;
+    Span method;
+    Span params;
+    Span id;
+    Span result;
+    Span error;
+  };
+
+  JsonReader(const char* buffer, const Envelope& envelope)
+      : myBuffer(buffer), mySize(envelope.text.offset + envelope.text.size),
+        myEnvelope(envelope) {
+  }
+
+  const char* Data() const {
+    return myBuffer;
+  }
+
+  // Not scanned yet
+  JsonReader(const char* buffer, size_t size)
+      : myBuffer(buffer), mySize(size) {
+  }
+
+  // False when the input is not valid JSON
+  bool Scan() {
+    JsonScanner scanner(Data(), Data() + mySize);
+    myEnvelope.text.size = mySize;
+    const char first = scanner.Peek();
+    if (first == '{') {
+      ScanEnvelope(scanner, myEnvelope, 0);
+    } else if (first == '[') {
+      myIsBatch = true;
+      bool firstElement = true;
+      while (scanner.NextElement(firstElement)) {
+        myBatch.emplace_back();
+        Envelope& envelope = myBatch.back();
+        const char element = scanner.Peek();
+        envelope.text.offset = scanner.GetPosition() - Data();
+        if (element == '{') {
+          ScanEnvelope(scanner, envelope, 1);
+        } else {
+          scanner.SkipValue(1);
+        }
+        envelope.text.size = scanner.GetPosition() - Data() - envelope.text.offset;
+      }
+    } else {
+      scanner.SkipValue();
+    }
+
+    return !scanner.Failed() && scanner.AtEnd();
+  }
+
+  // Takes the slow path to report the same error json11 would
+  std::string GetParseError() const {
+    std::string err;
+    Json::parse(std::string(Data(), mySize), err);
+    return err.empty() ? "Parse error" : "Parse error: " + err;
+  }
+
+  void ScanEnvelope(JsonScanner& scanner, Envelope& envelope, int depth) const {
+    envelope.isObject = true;
+    bool first = true;
+    StringRef key;
+    bool escaped;
+    while (scanner.NextMember(first, key, escaped)) {
+      StringRef value;
+      if (!scanner.ScanValue(value, depth + 1)) {
+        return;
+      }
+
+      Span* span = nullptr;
+      if (IsKey(key, escaped, json::JSONRPC_NAME)) {
+        span = &envelope.jsonrpc;
+      } else if (IsKey(key, escaped, json::METHOD_NAME)) {
+        span = &envelope.method;
+      } else if (IsKey(key, escaped, json::PARAMS_NAME)) {
+        span = &envelope.params;
+      } else if (IsKey(key, escaped, json::ID_NAME)) {
+        span = &envelope.id;
+      } else if (IsKey(key, escaped, json::RESULT_NAME)) {
+        span = &envelope.result;
+      } else if (IsKey(key, escaped, json::ERROR_NAME)) {
+        span = &envelope.error;
+      }
+      if (span) {
+        // json11 keeps the last of duplicated keys, so do we
+        span->offset = value.data() - Data();
+        span->size = value.size();
+      }
+    }
+  }
+
+  static bool IsKey(StringRef key, bool escaped, const char* name) {
+    if (escaped) {
+      return JsonScanner::Unescape(key) == name;
+    }
+    return key == StringRef(name, strlen(name));
+  }
+
+  StringRef GetText(const Span& span) const {
+    return StringRef(Data() + span.offset, span.size);
+  }
+
+  bool IsNull(const Span& span) const {
+    return span.size == 0 || GetText(span) == StringRef("null", 4);
+  }
+
+  bool IsString(const Span& span) const {
+    return span.size != 0 && Data()[span.offset] == '"';
+  }
+
+  std::string GetString(const Span& span) const {
+    StringRef raw(Data() + span.offset + 1, span.size - 2);
+    const bool escaped = memchr(raw.data(), '\\', raw.size()) != nullptr;
+    return JsonScanner::GetString(raw, escaped);
+  }
+
+  bool HasJsonrpcVersion() const {
+    return IsString(myEnvelope.jsonrpc)
+        && GetString(myEnvelope.jsonrpc) == json::JSONRPC_VERSION_2_0;
+  }
+
+  Expected<Json> ReadId(const Span& span) const {
+    if (IsString(span)) {
+      return Json(GetString(span));
     }
+
+    StringRef text = GetText(span);
+    if (text[0] == '-' || JsonScanner::IsDigit(text[0])) {
+      // copied, the buffer does not have to be null terminated
+      return Json(strtod(std::string(text.data(), text.size()).c_str(), nullptr));
+    }
+
+    return InvalidRequestFault();
   }
 
   Json CheckId(const Json& id) const {
@@ -148,8 +384,14 @@ class JsonReader {
     throw InvalidRequestFault();
   }
 
-  std::string myData;
-  //rapidjson::Document myDocument;
+  // null when reading the caller's text
+  std::shared_ptr<const std::string> myData;
+  const char* myBuffer;
+  size_t mySize;
+  Envelope myEnvelope;
+  bool myIsBatch = false;
+  std::vector<Envelope> myBatch;
+  bool myHasDocument = false;
   json11::Json myDocument;
 };
 
@@ -0,0 +1,350 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_JSONSCANNER_H
+#define JSONRPC_LEAN_JSONSCANNER_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace jsonrpc {
+
+    // Non owning reference to a range of characters, usually a slice of a request buffer
+    class StringRef {
+    public:
+        StringRef() : myData(nullptr), mySize(0) {}
+        StringRef(const char* data, size_t size) : myData(data), mySize(size) {}
+        StringRef(const char* begin, const char* end) : myData(begin), mySize(end - begin) {}
+        StringRef(const std::string& str) : myData(str.data()), mySize(str.size()) {}
+
+        const char* data() const { return myData; }
+        size_t size() const { return mySize; }
+        bool empty() const { return mySize == 0; }
+        const char* begin() const { return myData; }
+        const char* end() const { return myData + mySize; }
+        char operator[](size_t i) const { return myData[i]; }
+
+        std::string str() const { return std::string(myData, mySize); }
+
+        bool operator==(const StringRef& other) const {
+            return mySize == other.mySize && (mySize == 0 || memcmp(myData, other.myData, mySize) == 0);
+        }
+        bool operator!=(const StringRef& other) const { return !(*this == other); }
+
+    private:
+        const char* myData;
+        size_t mySize;
+    };
+
+    // Validating single pass scanner over a JSON text. It accepts exactly what
+    // json11 accepts, but only reports where values are instead of building them.
+    class JsonScanner {
+    public:
+        static const int MAX_DEPTH = 200;
+
+        JsonScanner(const char* begin, const char* end) : myPos(begin), myEnd(end), myFailed(false) {}
+        explicit JsonScanner(StringRef text) : JsonScanner(text.begin(), text.end()) {}
+
+        bool Failed() const { return myFailed; }
+        const char* GetPosition() const { return myPos; }
+
+        void SkipWhitespace() {
+            while (myPos != myEnd && (*myPos == ' ' || *myPos == '\r' || *myPos == '\n' || *myPos == '\t')) {
+                ++myPos;
+            }
+        }
+
+        bool AtEnd() {
+            SkipWhitespace();
+            return myPos == myEnd;
+        }
+
+        // Next significant character, '\0' at the end of the input
+        char Peek() {
+            SkipWhitespace();
+            return myPos == myEnd ? '\0' : *myPos;
+        }
+
+        bool Consume(char c) {
+            if (Peek() != c) {
+                return Fail();
+            }
+            ++myPos;
+            return true;
+        }
+
+        // String value, raw is what is between the quotes, still escaped
+        bool ScanString(StringRef& raw, bool& escaped) {
+            if (!Consume('"')) {
+                return false;
+            }
+            const char* begin = myPos;
+            escaped = false;
+            while (myPos != myEnd) {
+                const char ch = *myPos++;
+                if (ch == '"') {
+                    raw = StringRef(begin, myPos - 1);
+                    return true;
+                }
+                if (ch >= 0 && ch <= 0x1f) {
+                    return Fail();
+                }
+                if (ch != '\\') {
+                    continue;
+                }
+                if (myPos == myEnd) {
+                    break;
+                }
+                escaped = true;
+                const char esc = *myPos++;
+                if (esc == 'u') {
+                    for (int i = 0; i < 4; ++i, ++myPos) {
+                        if (myPos == myEnd || !IsHex(*myPos)) {
+                            return Fail();
+                        }
+                    }
+                } else if (esc == '\0' || !strchr("bfnrt\"\\/", esc)) {
+                    return Fail();
+                }
+            }
+            return Fail();
+        }
+
+        bool ScanNumber(StringRef& raw) {
+            SkipWhitespace();
+            const char* begin = myPos;
+            if (Current() == '-') {
+                ++myPos;
+            }
+            if (Current() == '0') {
+                ++myPos;
+                if (IsDigit(Current())) {
+                    return Fail();
+                }
+            } else if (Current() >= '1' && Current() <= '9') {
+                SkipDigits();
+            } else {
+                return Fail();
+            }
+            if (Current() == '.') {
+                ++myPos;
+                if (!IsDigit(Current())) {
+                    return Fail();
+                }
+                SkipDigits();
+            }
+            if (Current() == 'e' || Current() == 'E') {
+                ++myPos;
+                if (Current() == '+' || Current() == '-') {
+                    ++myPos;
+                }
+                if (!IsDigit(Current())) {
+                    return Fail();
+                }
+                SkipDigits();
+            }
+            raw = StringRef(begin, myPos);
+            return true;
+        }
+
+        // Any value; value is set to its complete text
+        bool ScanValue(StringRef& value, int depth = 0) {
+            if (depth > MAX_DEPTH) {
+                return Fail();
+            }
+            const char c = Peek();
+            const char* begin = myPos;
+            bool ok;
+            if (c == '"') {
+                StringRef raw;
+                bool escaped;
+                ok = ScanString(raw, escaped);
+            } else if (c == '-' || IsDigit(c)) {
+                StringRef raw;
+                ok = ScanNumber(raw);
+            } else if (c == 't') {
+                ok = Expect("true");
+            } else if (c == 'f') {
+                ok = Expect("false");
+            } else if (c == 'n') {
+                ok = Expect("null");
+            } else if (c == '{') {
+                ok = ScanContainer('}', depth);
+            } else if (c == '[') {
+                ok = ScanContainer(']', depth);
+            } else {
+                ok = Fail();
+            }
+            if (ok) {
+                value = StringRef(begin, myPos);
+            }
+            return ok;
+        }
+
+        bool SkipValue(int depth = 0) {
+            StringRef value;
+            return ScanValue(value, depth);
+        }
+
+        // Steps into an array: true while there is one more element to scan.
+        // Call with first set to true for the first element.
+        bool NextElement(bool& first) {
+            if (first) {
+                first = false;
+                if (!Consume('[')) {
+                    return false;
+                }
+                if (Peek() == ']') {
+                    ++myPos;
+                    return false;
+                }
+                return true;
+            }
+            if (Peek() == ',') {
+                ++myPos;
+                return true;
+            }
+            Consume(']');
+            return false;
+        }
+
+        // Steps into an object: true and key set while there is one more member.
+        // The value of the member must be scanned before calling this again.
+        bool NextMember(bool& first, StringRef& key, bool& escaped) {
+            if (first) {
+                first = false;
+                if (!Consume('{')) {
+                    return false;
+                }
+                if (Peek() == '}') {
+                    ++myPos;
+                    return false;
+                }
+            } else if (Peek() == ',') {
+                ++myPos;
+            } else {
+                Consume('}');
+                return false;
+            }
+            return ScanString(key, escaped) && Consume(':');
+        }
+
+        // Resolves the escapes of a raw string the same way json11 does
+        static std::string Unescape(StringRef raw) {
+            std::string out;
+            out.reserve(raw.size());
+            long lastCodepoint = -1;
+            for (const char* p = raw.begin(); p != raw.end(); ++p) {
+                if (*p != '\\') {
+                    EncodeUtf8(lastCodepoint, out);
+                    lastCodepoint = -1;
+                    out += *p;
+                    continue;
+                }
+                const char esc = *++p;
+                if (esc == 'u') {
+                    const char hex[5] = { p[1], p[2], p[3], p[4], '\0' };
+                    const long codepoint = strtol(hex, nullptr, 16);
+                    p += 4;
+                    if (lastCodepoint >= 0xD800 && lastCodepoint <= 0xDBFF
+                        && codepoint >= 0xDC00 && codepoint <= 0xDFFF) {
+                        EncodeUtf8((((lastCodepoint - 0xD800) << 10) | (codepoint - 0xDC00)) + 0x10000, out);
+                        lastCodepoint = -1;
+                    } else {
+                        EncodeUtf8(lastCodepoint, out);
+                        lastCodepoint = codepoint;
+                    }
+                    continue;
+                }
+                EncodeUtf8(lastCodepoint, out);
+                lastCodepoint = -1;
+                switch (esc) {
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                default: out += esc; break;
+                }
+            }
+            EncodeUtf8(lastCodepoint, out);
+            return out;
+        }
+
+        static std::string GetString(StringRef raw, bool escaped) {
+            return escaped ? Unescape(raw) : raw.str();
+        }
+
+        static bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+
+    private:
+        char Current() const { return myPos == myEnd ? '\0' : *myPos; }
+
+        void SkipDigits() {
+            while (IsDigit(Current())) {
+                ++myPos;
+            }
+        }
+
+        static bool IsHex(char c) {
+            return IsDigit(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+        }
+
+        bool Fail() {
+            myFailed = true;
+            return false;
+        }
+
+        bool Expect(const char* literal) {
+            const size_t length = strlen(literal);
+            if (static_cast<size_t>(myEnd - myPos) < length || memcmp(myPos, literal, length) != 0) {
+                return Fail();
+            }
+            myPos += length;
+            return true;
+        }
+
+        bool ScanContainer(char close, int depth) {
+            const bool isObject = close == '}';
+            bool first = true;
+            StringRef key;
+            bool escaped;
+            while (isObject ? NextMember(first, key, escaped) : NextElement(first)) {
+                if (!SkipValue(depth + 1)) {
+                    return false;
+                }
+            }
+            return !myFailed;
+        }
+
+        static void EncodeUtf8(long pt, std::string& out) {
+            if (pt < 0) {
+                return;
+            }
+            if (pt < 0x80) {
+                out += static_cast<char>(pt);
+            } else if (pt < 0x800) {
+                out += static_cast<char>((pt >> 6) | 0xC0);
+                out += static_cast<char>((pt & 0x3F) | 0x80);
+            } else if (pt < 0x10000) {
+                out += static_cast<char>((pt >> 12) | 0xE0);
+                out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+                out += static_cast<char>((pt & 0x3F) | 0x80);
+            } else {
+                out += static_cast<char>((pt >> 18) | 0xF0);
+                out += static_cast<char>(((pt >> 12) & 0x3F) | 0x80);
+                out += static_cast<char>(((pt >> 6) & 0x3F) | 0x80);
+                out += static_cast<char>((pt & 0x3F) | 0x80);
+            }
+        }
+
+        const char* myPos;
+        const char* myEnd;
+        bool myFailed;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_JSONSCANNER_H
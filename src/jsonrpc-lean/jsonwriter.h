@@ -0,0 +1,112 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_JSONWRITER_H
+#define JSONRPC_LEAN_JSONWRITER_H
+
+#include "json.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace jsonrpc {
+
+    // Appends JSON text to a caller owned buffer, formatted exactly like
+    // json11::Json::dump() so both can be mixed in one document.
+    class JsonWriter {
+    public:
+        explicit JsonWriter(std::string& out) : myOut(out) {}
+
+        std::string& GetBuffer() { return myOut; }
+
+        void Raw(const char* data, size_t size) { myOut.append(data, size); }
+        void Raw(const char* str) { myOut.append(str); }
+        void Raw(char c) { myOut += c; }
+
+        // Key of an object member, first tells whether a separator is needed
+        void Key(const char* name, bool first = false) {
+            if (!first) {
+                myOut.append(", ", 2);
+            }
+            String(name, strlen(name));
+            myOut.append(": ", 2);
+        }
+
+        void Null() { myOut.append("null", 4); }
+        void Bool(bool value) { value ? myOut.append("true", 4) : myOut.append("false", 5); }
+
+        void Int(int32_t value) {
+            char buffer[16];
+            myOut.append(buffer, snprintf(buffer, sizeof(buffer), "%d", static_cast<int>(value)));
+        }
+
+        void Double(double value) {
+            if (!std::isfinite(value)) {
+                Null();
+                return;
+            }
+            char buffer[32];
+            myOut.append(buffer, snprintf(buffer, sizeof(buffer), "%.17g", value));
+        }
+
+        void String(const std::string& value) { String(value.data(), value.size()); }
+
+        void String(const char* data, size_t size) {
+            myOut.reserve(myOut.size() + size + 2);
+            myOut += '"';
+            const char* run = data;
+            const char* end = data + size;
+            for (const char* p = data; p != end; ++p) {
+                const uint8_t ch = static_cast<uint8_t>(*p);
+                if (ch >= 0x20 && ch != '"' && ch != '\\' && ch != 0xe2) {
+                    continue;
+                }
+                // flush the run of characters that need no escaping
+                const char* escape = nullptr;
+                switch (ch) {
+                case '"': escape = "\\\""; break;
+                case '\\': escape = "\\\\"; break;
+                case '\b': escape = "\\b"; break;
+                case '\f': escape = "\\f"; break;
+                case '\n': escape = "\\n"; break;
+                case '\r': escape = "\\r"; break;
+                case '\t': escape = "\\t"; break;
+                default: break;
+                }
+                if (ch == 0xe2) {
+                    // U+2028 and U+2029 are valid JSON but not valid javascript
+                    if (end - p < 3 || static_cast<uint8_t>(p[1]) != 0x80
+                        || (static_cast<uint8_t>(p[2]) != 0xa8 && static_cast<uint8_t>(p[2]) != 0xa9)) {
+                        continue;
+                    }
+                    myOut.append(run, p - run);
+                    myOut.append(static_cast<uint8_t>(p[2]) == 0xa8 ? "\\u2028" : "\\u2029", 6);
+                    p += 2;
+                    run = p + 1;
+                    continue;
+                }
+                myOut.append(run, p - run);
+                if (escape) {
+                    myOut.append(escape);
+                } else {
+                    char buffer[8];
+                    myOut.append(buffer, snprintf(buffer, sizeof(buffer), "\\u%04x", ch));
+                }
+                run = p + 1;
+            }
+            myOut.append(run, end - run);
+            myOut += '"';
+        }
+
+        void Value(const Json& value) { value.dump(myOut); }
+
+    private:
+        std::string& myOut;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_JSONWRITER_H
@@ -0,0 +1,113 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_METHODINDEX_H
+#define JSONRPC_LEAN_METHODINDEX_H
+
+#include "jsonscanner.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Open addressing hash table from a method name to what it resolves to.
+    // It is rebuilt whenever the registrations change, so lookups are a single
+    // probe sequence over a flat array and never allocate. Names are not
+    // copied, they must outlive the index.
+    template<typename T>
+    class MethodIndex {
+    public:
+        MethodIndex() : myCount(0) {}
+
+        // Empties the index and sizes it for count names
+        void Reset(size_t count) {
+            size_t capacity = 8;
+            while (capacity < 2 * count) {
+                capacity *= 2;
+            }
+            mySlots.assign(capacity, Slot());
+            myCount = 0;
+        }
+
+        // Replaces the value when name is already there
+        void Insert(StringRef name, T value) {
+            if (2 * (myCount + 1) > mySlots.size()) {
+                Grow();
+            }
+            const uint64_t hash = Hash(name.data(), name.size());
+            Slot* slot = Probe(hash, name.data(), name.size());
+            if (!slot->used) {
+                slot->used = true;
+                slot->hash = hash;
+                slot->name = name;
+                ++myCount;
+            }
+            slot->value = std::move(value);
+        }
+
+        const T* Find(const char* name, size_t size) const {
+            if (mySlots.empty()) {
+                return nullptr;
+            }
+            const Slot* slot = Probe(Hash(name, size), name, size);
+            return slot->used ? &slot->value : nullptr;
+        }
+
+        const T* Find(StringRef name) const {
+            return Find(name.data(), name.size());
+        }
+
+        size_t GetSize() const { return myCount; }
+
+        // FNV-1a
+        static uint64_t Hash(const char* data, size_t size) {
+            uint64_t hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= static_cast<uint8_t>(data[i]);
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+    private:
+        struct Slot {
+            Slot() : hash(0), value(), used(false) {}
+            uint64_t hash;
+            StringRef name;
+            T value;
+            bool used;
+        };
+
+        Slot* Probe(uint64_t hash, const char* name, size_t size) {
+            return const_cast<Slot*>(static_cast<const MethodIndex*>(this)->Probe(hash, name, size));
+        }
+
+        const Slot* Probe(uint64_t hash, const char* name, size_t size) const {
+            const size_t mask = mySlots.size() - 1;
+            for (size_t i = hash & mask;; i = (i + 1) & mask) {
+                const Slot& slot = mySlots[i];
+                if (!slot.used || (slot.hash == hash && slot.name == StringRef(name, size))) {
+                    return &slot;
+                }
+            }
+        }
+
+        void Grow() {
+            std::vector<Slot> slots;
+            slots.swap(mySlots);
+            Reset(slots.empty() ? 4 : slots.size());
+            for (auto& slot : slots) {
+                if (slot.used) {
+                    Insert(slot.name, std::move(slot.value));
+                }
+            }
+        }
+
+        std::vector<Slot> mySlots;
+        size_t myCount;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_METHODINDEX_H
@@ -0,0 +1,271 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_METHODSTATS_H
+#define JSONRPC_LEAN_METHODSTATS_H
+
+#include "json.h"
+#include "response.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Call counts, fault counts by code and a latency histogram of a method.
+    // Calls are counted in shards picked by the calling thread, each one
+    // allocated by the first call made through it, so that threads calling
+    // the same method seldom share a cache line.
+    //
+    // The histogram has log-linear buckets like HDR histograms: four per
+    // power of two, so a percentile is at most 25% above the exact value.
+    //
+    // With JSONRPC_LEAN_DISABLE_STATS defined, nothing is measured nor
+    // recorded, and snapshots are empty.
+    class MethodStats {
+    public:
+        // Buckets cover 2^MIN_EXPONENT ns to 2^MAX_EXPONENT ns, 64 ns to 69 s,
+        // with one more bucket below and one above
+        static const int MIN_EXPONENT = 6;
+        static const int MAX_EXPONENT = 36;
+        static const size_t SUB_BUCKETS = 4;
+        static const size_t BUCKETS = (MAX_EXPONENT - MIN_EXPONENT) * SUB_BUCKETS + 2;
+
+        struct Snapshot {
+            uint64_t calls = 0;
+            uint64_t faults = 0;
+            uint64_t totalNanoseconds = 0;
+            uint64_t maxNanoseconds = 0;
+            std::vector<uint64_t> histogram = std::vector<uint64_t>(BUCKETS);
+            std::map<int32_t, uint64_t> faultCodes;
+            // faults with a code past the first ones the table keeps
+            uint64_t otherFaultCodes = 0;
+
+            double GetMeanNanoseconds() const {
+                return calls == 0 ? 0 : static_cast<double>(totalNanoseconds) / calls;
+            }
+
+            // The upper bound of the bucket holding the percentile, 0 to 100
+            uint64_t GetPercentileNanoseconds(double percentile) const {
+                if (calls == 0) {
+                    return 0;
+                }
+                const double rank = percentile / 100 * calls;
+                uint64_t count = 0;
+                for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+                    count += histogram[bucket];
+                    if (count > 0 && count >= rank) {
+                        return std::min(GetUpperBound(bucket), maxNanoseconds);
+                    }
+                }
+                return maxNanoseconds;
+            }
+
+            // As returned by system.stats, in microseconds
+            Json ToJson() const {
+                Json::object codes;
+                for (auto& code : faultCodes) {
+                    codes[std::to_string(code.first)] = static_cast<double>(code.second);
+                }
+                return Json::object{
+                    { "calls", static_cast<double>(calls) },
+                    { "faults", static_cast<double>(faults) },
+                    { "fault_codes", codes },
+                    { "other_fault_codes", static_cast<double>(otherFaultCodes) },
+                    { "mean_us", GetMeanNanoseconds() / 1000 },
+                    { "p50_us", GetPercentileNanoseconds(50) / 1000.0 },
+                    { "p90_us", GetPercentileNanoseconds(90) / 1000.0 },
+                    { "p99_us", GetPercentileNanoseconds(99) / 1000.0 },
+                    { "max_us", maxNanoseconds / 1000.0 }
+                };
+            }
+        };
+
+        MethodStats() {
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+            for (auto& shard : myShards) {
+                shard.store(nullptr);
+            }
+            for (auto& fault : myFaultCodes) {
+                fault.code.store(NO_CODE);
+                fault.count.store(0);
+            }
+            myOtherFaultCodes.store(0);
+#endif
+        }
+
+        ~MethodStats() {
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+            for (auto& shard : myShards) {
+                delete shard.load();
+            }
+#endif
+        }
+
+        MethodStats(const MethodStats&) = delete;
+        MethodStats& operator=(const MethodStats&) = delete;
+
+        static size_t GetBucket(uint64_t nanoseconds) {
+            if (nanoseconds < (uint64_t(1) << MIN_EXPONENT)) {
+                return 0;
+            }
+            int exponent = 63;
+            while (!(nanoseconds >> exponent)) {
+                --exponent;
+            }
+            if (exponent >= MAX_EXPONENT) {
+                return BUCKETS - 1;
+            }
+            const size_t sub = (nanoseconds >> (exponent - 2)) & (SUB_BUCKETS - 1);
+            return 1 + (exponent - MIN_EXPONENT) * SUB_BUCKETS + sub;
+        }
+
+        static uint64_t GetUpperBound(size_t bucket) {
+            if (bucket == 0) {
+                return uint64_t(1) << MIN_EXPONENT;
+            }
+            if (bucket == BUCKETS - 1) {
+                return UINT64_MAX;
+            }
+            const int exponent = MIN_EXPONENT + static_cast<int>((bucket - 1) / SUB_BUCKETS);
+            const uint64_t sub = (bucket - 1) % SUB_BUCKETS;
+            return (SUB_BUCKETS + sub + 1) << (exponent - 2);
+        }
+
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+        void Record(uint64_t nanoseconds, const Response& response) {
+            Shard& shard = GetShard();
+            shard.calls.fetch_add(1, std::memory_order_relaxed);
+            shard.totalNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+            shard.histogram[GetBucket(nanoseconds)].fetch_add(1, std::memory_order_relaxed);
+            uint64_t max = shard.maxNanoseconds.load(std::memory_order_relaxed);
+            while (nanoseconds > max && !shard.maxNanoseconds.compare_exchange_weak(max, nanoseconds, std::memory_order_relaxed)) {
+            }
+            if (response.IsFault()) {
+                shard.faults.fetch_add(1, std::memory_order_relaxed);
+                CountFault(response.GetFaultCode());
+            }
+        }
+#else
+        void Record(uint64_t, const Response&) {}
+#endif
+
+        // Counts are read one by one while calls go on, so they can be a few
+        // calls apart from each other
+        Snapshot GetSnapshot() const {
+            Snapshot snapshot;
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+            for (auto& pointer : myShards) {
+                const Shard* shard = pointer.load(std::memory_order_acquire);
+                if (!shard) {
+                    continue;
+                }
+                snapshot.calls += shard->calls.load(std::memory_order_relaxed);
+                snapshot.faults += shard->faults.load(std::memory_order_relaxed);
+                snapshot.totalNanoseconds += shard->totalNanoseconds.load(std::memory_order_relaxed);
+                snapshot.maxNanoseconds = std::max(snapshot.maxNanoseconds, shard->maxNanoseconds.load(std::memory_order_relaxed));
+                for (size_t bucket = 0; bucket < BUCKETS; ++bucket) {
+                    snapshot.histogram[bucket] += shard->histogram[bucket].load(std::memory_order_relaxed);
+                }
+            }
+            for (auto& fault : myFaultCodes) {
+                const int64_t code = fault.code.load(std::memory_order_acquire);
+                if (code != NO_CODE) {
+                    snapshot.faultCodes[static_cast<int32_t>(code)] += fault.count.load(std::memory_order_relaxed);
+                }
+            }
+            snapshot.otherFaultCodes = myOtherFaultCodes.load(std::memory_order_relaxed);
+#endif
+            return snapshot;
+        }
+
+    private:
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+        static const size_t SHARDS = 16;
+        static const size_t FAULT_CODES = 8;
+        static const int64_t NO_CODE = INT64_MIN;
+
+        struct Shard {
+            Shard() : calls(0), faults(0), totalNanoseconds(0), maxNanoseconds(0) {
+                for (auto& count : histogram) {
+                    count.store(0, std::memory_order_relaxed);
+                }
+            }
+
+            std::atomic<uint64_t> calls;
+            std::atomic<uint64_t> faults;
+            std::atomic<uint64_t> totalNanoseconds;
+            std::atomic<uint64_t> maxNanoseconds;
+            std::atomic<uint64_t> histogram[BUCKETS];
+            // keeps the next allocation off the last cache line
+            char padding[64];
+        };
+
+        struct FaultCode {
+            std::atomic<int64_t> code;
+            std::atomic<uint64_t> count;
+        };
+
+        Shard& GetShard() {
+            static std::atomic<size_t> nextIndex(0);
+            static thread_local size_t index = nextIndex++ % SHARDS;
+            Shard* shard = myShards[index].load(std::memory_order_acquire);
+            if (!shard) {
+                Shard* created = new Shard();
+                if (myShards[index].compare_exchange_strong(shard, created, std::memory_order_acq_rel)) {
+                    shard = created;
+                } else {
+                    delete created;
+                }
+            }
+            return *shard;
+        }
+
+        // Faults are rarer than calls, their codes are kept in one table
+        void CountFault(int32_t code) {
+            for (auto& fault : myFaultCodes) {
+                int64_t current = fault.code.load(std::memory_order_acquire);
+                if (current == NO_CODE && fault.code.compare_exchange_strong(current, code, std::memory_order_acq_rel)) {
+                    current = code;
+                }
+                if (current == code) {
+                    fault.count.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            myOtherFaultCodes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        std::atomic<Shard*> myShards[SHARDS];
+        FaultCode myFaultCodes[FAULT_CODES];
+        std::atomic<uint64_t> myOtherFaultCodes;
+#endif
+    };
+
+    // Measures a call for MethodStats, and is empty with
+    // JSONRPC_LEAN_DISABLE_STATS
+    class CallTimer {
+    public:
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+        CallTimer() : myStart(std::chrono::steady_clock::now()) {}
+
+        void Record(MethodStats& stats, const Response& response) const {
+            const auto elapsed = std::chrono::steady_clock::now() - myStart;
+            stats.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()), response);
+        }
+
+    private:
+        std::chrono::steady_clock::time_point myStart;
+#else
+        void Record(MethodStats&, const Response&) const {}
+#endif
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_METHODSTATS_H
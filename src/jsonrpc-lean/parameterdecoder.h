@@ -0,0 +1,117 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_PARAMETERDECODER_H
+#define JSONRPC_LEAN_PARAMETERDECODER_H
+
+#include "integer_seq.h"
+#include "json.h"
+#include "jsonscanner.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <tuple>
+#include <type_traits>
+
+namespace jsonrpc {
+
+    // Converts the JSON text of one parameter to T without going through a
+    // Json. Decode() only accepts a value of the matching JSON type and
+    // returns false for anything else (null included), leaving the
+    // conversion and its error to Json::AsType.
+    template<typename T, typename Enable = void>
+    struct ParameterDecoder {
+        static const bool IsSupported = false;
+    };
+
+    template<typename T>
+    struct ParameterDecoder<T, typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value>::type> {
+        static const bool IsSupported = true;
+
+        static bool Decode(StringRef value, T& out) {
+            char buffer[64];
+            if (value.empty() || value.size() >= sizeof(buffer) || (value[0] != '-' && !JsonScanner::IsDigit(value[0]))) {
+                return false;
+            }
+            memcpy(buffer, value.data(), value.size());
+            buffer[value.size()] = '\0';
+            // json11 keeps every number as a double
+            out = static_cast<T>(strtod(buffer, nullptr));
+            return true;
+        }
+    };
+
+    template<>
+    struct ParameterDecoder<bool> {
+        static const bool IsSupported = true;
+
+        static bool Decode(StringRef value, bool& out) {
+            if (value == StringRef("true", 4)) {
+                out = true;
+            } else if (value == StringRef("false", 5)) {
+                out = false;
+            } else {
+                return false;
+            }
+            return true;
+        }
+    };
+
+    template<>
+    struct ParameterDecoder<std::string> {
+        static const bool IsSupported = true;
+
+        static bool Decode(StringRef value, std::string& out) {
+            if (value.empty() || value[0] != '"') {
+                return false;
+            }
+            // the request was validated already, only the escapes are left
+            if (memchr(value.data(), '\\', value.size())) {
+                out = JsonScanner::Unescape(StringRef(value.data() + 1, value.size() - 2));
+            } else {
+                out.assign(value.data() + 1, value.size() - 2);
+            }
+            return true;
+        }
+    };
+
+    // Converts a parameter held in a Json, for the calls that do not go
+    // through ParameterDecoder
+    template<typename T>
+    struct ParameterFromJson {
+        static T Get(const Json& value) {
+            return value.AsType<T>();
+        }
+    };
+
+    template<typename... Types>
+    struct AllDecodable;
+
+    template<>
+    struct AllDecodable<> : std::true_type {};
+
+    template<typename First, typename... Rest>
+    struct AllDecodable<First, Rest...> : std::integral_constant<bool,
+        ParameterDecoder<First>::IsSupported && AllDecodable<Rest...>::value> {};
+
+    // Decodes the leading elements of the JSON array params into values, one
+    // per element; further elements are ignored. False when there are too few
+    // elements or one of them does not decode.
+    template<typename... Types, std::size_t... index>
+    bool DecodeParameters(StringRef params, std::tuple<Types...>& values, redi::index_sequence<index...>) {
+        JsonScanner scanner(params);
+        bool first = true;
+        bool ok = true;
+        StringRef value;
+        // braced initializers are evaluated in order
+        const bool decoded[] = { (ok = ok && scanner.NextElement(first) && scanner.ScanValue(value)
+            && ParameterDecoder<Types>::Decode(value, std::get<index>(values)))..., true };
+        (void)decoded;
+        (void)first;
+        return ok;
+    }
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_PARAMETERDECODER_H
@@ -0,0 +1,145 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_RCU_H
+#define JSONRPC_LEAN_RCU_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Read-copy-update pointer to an immutable T. Readers take a ReadScope,
+    // which never locks nor waits for writers. A writer builds a new T and
+    // publishes it without waiting either: the previous one is deleted by a
+    // later Publish(), or the destructor, once no reader can see it anymore.
+    // Scopes are meant to be short, a value outlives those that may see it.
+    //
+    // Readers are counted by epoch parity, over a few counters picked by
+    // thread so that they do not all share one. The epoch only moves on
+    // once the readers of the one before it have left, so the readers
+    // still in a scope are those of the last two epochs.
+    template<typename T>
+    class RcuPtr {
+    public:
+        explicit RcuPtr(std::unique_ptr<const T> value) : myValue(value.release()), myEpoch(0) {
+            for (auto& readers : myReaders) {
+                readers.count[0] = 0;
+                readers.count[1] = 0;
+            }
+        }
+
+        ~RcuPtr() {
+            for (auto& retired : myRetired) {
+                delete retired.first;
+            }
+            delete myValue.load();
+        }
+
+        RcuPtr(const RcuPtr&) = delete;
+        RcuPtr& operator=(const RcuPtr&) = delete;
+
+        // The value stays valid for the lifetime of the scope. Scopes can be
+        // nested, and a reader may publish from within one.
+        class ReadScope {
+        public:
+            explicit ReadScope(const RcuPtr& rcu) {
+                Readers& readers = rcu.myReaders[GetSlot()];
+                for (;;) {
+                    const size_t epoch = rcu.myEpoch.load();
+                    myCount = &readers.count[epoch & 1];
+                    ++*myCount;
+                    // a writer moved the epoch on in between, it may not count us
+                    if (rcu.myEpoch.load() == epoch) {
+                        break;
+                    }
+                    --*myCount;
+                }
+                myValue = rcu.myValue.load();
+            }
+
+            ~ReadScope() {
+                --*myCount;
+            }
+
+            ReadScope(const ReadScope&) = delete;
+            ReadScope& operator=(const ReadScope&) = delete;
+
+            const T& operator*() const { return *myValue; }
+            const T* operator->() const { return myValue; }
+
+        private:
+            std::atomic<size_t>* myCount;
+            const T* myValue;
+        };
+
+        // Writers must not run concurrently, the caller serializes them.
+        // The current value can be read by the writer without a scope.
+        const T& GetForWriter() const { return *myValue.load(); }
+
+        void Publish(std::unique_ptr<const T> value) {
+            const T* previous = myValue.exchange(value.release());
+            const size_t epoch = myEpoch.load();
+            myRetired.emplace_back(previous, epoch);
+            // the readers of the epoch before have left, the next one can start
+            if (CountReaders(epoch + 1) == 0) {
+                myEpoch.store(epoch + 1);
+            }
+            Reclaim();
+        }
+
+        // Values published over but not deleted yet
+        size_t GetRetiredCount() const { return myRetired.size(); }
+
+    private:
+        static const size_t SLOTS = 16;
+
+        // on a cache line of its own, threads of other slots do not share it
+        struct Readers {
+            std::atomic<size_t> count[2];
+            char padding[64 - 2 * sizeof(std::atomic<size_t>)];
+        };
+
+        static size_t GetSlot() {
+            static std::atomic<size_t> next(0);
+            static thread_local size_t slot = next++ % SLOTS;
+            return slot;
+        }
+
+        size_t CountReaders(size_t epoch) const {
+            size_t count = 0;
+            for (auto& readers : myReaders) {
+                count += readers.count[epoch & 1].load();
+            }
+            return count;
+        }
+
+        // A value replaced during an epoch can only be seen by the readers
+        // of that epoch and of the one before
+        void Reclaim() {
+            const size_t epoch = myEpoch.load();
+            const bool previousLeft = CountReaders(epoch - 1) == 0;
+            size_t kept = 0;
+            for (auto& retired : myRetired) {
+                if (retired.second + 2 <= epoch || (retired.second + 1 == epoch && previousLeft)) {
+                    delete retired.first;
+                } else {
+                    myRetired[kept++] = retired;
+                }
+            }
+            myRetired.resize(kept);
+        }
+
+        std::atomic<const T*> myValue;
+        std::atomic<size_t> myEpoch;
+        mutable Readers myReaders[SLOTS];
+        // with the epoch during which they were replaced
+        std::vector<std::pair<const T*, size_t>> myRetired;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_RCU_H
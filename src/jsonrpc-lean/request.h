@@ -7,9 +7,13 @@
 #ifndef JSONRPC_LEAN_REQUEST_H
 #define JSONRPC_LEAN_REQUEST_H
 
+#include "arena.h"
 #include "json.h"
+#include "jsonscanner.h"
+#include "jsonwriter.h"
+#include "smallvector.h"
 
-#include <deque>
+#include <memory>
 #include <string>
 
 namespace jsonrpc {
@@ -18,7 +22,9 @@ namespace jsonrpc {
 
     class Request {
     public:
-        typedef std::deque<Json> Parameters;
+        // Contiguous, up to four parameters are stored inline. Larger lists
+        // are heap allocated unless given the allocator of an Arena.
+        typedef SmallVector<Json, 4, ArenaAllocator<Json>> Parameters;
 
         Request(std::string methodName, Parameters parameters, Json id)
             : myMethodName(std::move(methodName)),
@@ -27,32 +33,96 @@ namespace jsonrpc {
             // Empty
         }
 
+        // params is the still unparsed JSON array of a request, it is only
+        // turned into Parameters by the first GetParameters(). Unless text
+        // owns it, it must stay valid until then: the request refers to it.
+        // They are allocated from the current Arena, if any.
+        Request(std::string methodName, StringRef params, Json id, std::shared_ptr<const std::string> text = nullptr)
+            : myMethodName(std::move(methodName)),
+            myParameters(Parameters::allocator_type(Arena::GetCurrent())),
+            myRawParameters(params),
+            myText(std::move(text)),
+            myId(std::move(id)) {
+            // Empty
+        }
+
         const std::string& GetMethodName() const { return myMethodName; }
-        const Parameters& GetParameters() const { return myParameters; }
+
+        // The first call parses the params into the request, hence not
+        // const: a request read by several threads is parsed before
+        const Parameters& GetParameters() {
+            if (!myRawParameters.empty()) {
+                const Json params = Parse(myRawParameters);
+                myParameters.assign(params.array_items().begin(), params.array_items().end());
+                myRawParameters = StringRef();
+                myText.reset();
+            }
+            return myParameters;
+        }
+
+        // The JSON text of the params array while GetParameters() was not
+        // called yet, empty otherwise
+        StringRef GetRawParameters() const { return myRawParameters; }
+
+        // Moves the parameters out of the request, leaving it without any
+        Parameters TakeParameters() {
+            GetParameters();
+            return std::move(myParameters);
+        }
+
         const Json& GetId() const { return myId; }
 
+        // Leaves unparsed params as they are
         std::string Write() const {
+            if (!myRawParameters.empty()) {
+                const Json params = Parse(myRawParameters);
+                return Write(myMethodName, Parameters(params.array_items().begin(), params.array_items().end()), myId);
+            }
             return Write(myMethodName, myParameters, myId);
         }
 
         static std::string Write(const std::string& methodName, const Parameters& params, const Json& id) {
-        Json::object RequestJson;
-        RequestJson[json::JSONRPC_NAME] = json::JSONRPC_VERSION_2_0;
-        RequestJson[json::METHOD_NAME] = methodName;
-        RequestJson[json::ID_NAME] = id;
-
-        Json::array array;
-        for (auto& param : params) {
-            array.push_back(param);
+            std::string out;
+            Write(out, methodName, params, id);
+            return out;
         }
-        RequestJson[json::PARAMS_NAME] = Json(array);
 
-        return Json(RequestJson).dump();
+        // Appends the request to out, without building the document. A
+        // notification, with a false id, is written without any id.
+        static void Write(std::string& out, const std::string& methodName, const Parameters& params, const Json& id) {
+            JsonWriter writer(out);
+            writer.Raw('{');
+            const bool notification = id.is_bool() && !id.bool_value();
+            if (!notification) {
+                writer.Key(json::ID_NAME, true);
+                writer.Value(id);
+            }
+            writer.Key(json::JSONRPC_NAME, notification);
+            writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+            writer.Key(json::METHOD_NAME);
+            writer.String(methodName);
+            writer.Key(json::PARAMS_NAME);
+            writer.Raw('[');
+            for (size_t i = 0; i < params.size(); ++i) {
+                if (i > 0) {
+                    writer.Raw(", ", 2);
+                }
+                writer.Value(params[i]);
+            }
+            writer.Raw(']');
+            writer.Raw('}');
         }
 
     private:
+        static Json Parse(StringRef params) {
+            std::string err;
+            return Json::parse(params.str(), err);
+        }
+
         std::string myMethodName;
         Parameters myParameters;
+        StringRef myRawParameters;
+        std::shared_ptr<const std::string> myText;
         Json myId;
     };
 
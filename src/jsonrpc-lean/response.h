@@ -7,7 +7,11 @@
 #ifndef JSONRPC_LEAN_RESPONSE_H
 #define JSONRPC_LEAN_RESPONSE_H
 
+#include "fault.h"
 #include "json.h"
+#include "jsonwriter.h"
+
+#include <string>
 
 namespace jsonrpc {
 
@@ -24,6 +28,9 @@ namespace jsonrpc {
             myFaultString(std::move(faultString)),
             myId(std::move(id)) {
         }
+        Response(const Fault& fault, Json id) : Response(fault.GetCode(), fault.GetString(), std::move(id)) {
+        }
+
         Response(int32_t faultCode, std::string faultString, std::string faultData, Json id) : myIsFault(true),
             myFaultCode(faultCode),
             myFaultString(std::move(faultString)),
@@ -31,11 +38,30 @@ namespace jsonrpc {
             myId(std::move(id)) {
         }
 
+        // result is the JSON text of the result, written out as is and only
+        // parsed if GetResult() is called. For the responses that are
+        // written out, the others keep the Json of their result.
+        static Response FromResultText(std::string result, Json id) {
+            Response response(Json(), std::move(id));
+            response.myResultText = std::move(result);
+            return response;
+        }
+
+        // The JSON text of the result, as Write() puts it in the response
+        std::string GetResultText() const {
+            if (!myResultText.empty()) {
+                return myResultText;
+            }
+            std::string text;
+            JsonWriter(text).Value(myResult);
+            return text;
+        }
+
         Json::object ResponseObject() const {
             Json::object ResponseJson;
             ResponseJson[json::JSONRPC_NAME] = json::JSONRPC_VERSION_2_0;
             ResponseJson[json::ID_NAME] = myId;
-            return std::move(ResponseJson);
+            return ResponseJson;
         }
 
         Json Write() const {
@@ -48,54 +74,75 @@ namespace jsonrpc {
                 ResponseJson[json::ERROR_NAME] = Json(ErrorJson);
             } else {
                 ResponseJson[json::ID_NAME] = myId;
-                ResponseJson[json::RESULT_NAME] = myResult;
+                ResponseJson[json::RESULT_NAME] = myResultText.empty() ? myResult : ParseResultText();
             }
             return Json(ResponseJson);
         }
 
-        Json& GetResult() { return myResult; }
-        bool IsFault() const { return myIsFault; }
-
-        void ThrowIfFault() const {
-            if (!IsFault()) {
-                return;
+        // Appends the same text as Write().dump() to out, without building the document
+        void Write(std::string& out) const {
+            JsonWriter writer(out);
+            writer.Raw('{');
+            if (myIsFault) {
+                writer.Key(json::ERROR_NAME, true);
+                writer.Raw('{');
+                writer.Key(json::ERROR_CODE_NAME, true);
+                writer.Int(myFaultCode);
+                if (!myFaultData.empty()) {
+                    writer.Key(json::ERROR_DATA_NAME);
+                    writer.String(myFaultData);
+                }
+                writer.Key(json::ERROR_MESSAGE_NAME);
+                writer.String(myFaultString);
+                writer.Raw('}');
+                writer.Key(json::ID_NAME);
+                writer.Value(myId);
+                writer.Key(json::JSONRPC_NAME);
+                writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+            } else {
+                writer.Key(json::ID_NAME, true);
+                writer.Value(myId);
+                writer.Key(json::JSONRPC_NAME);
+                writer.String(json::JSONRPC_VERSION_2_0, sizeof(json::JSONRPC_VERSION_2_0) - 1);
+                writer.Key(json::RESULT_NAME);
+                if (myResultText.empty()) {
+                    writer.Value(myResult);
+                } else {
+                    writer.Raw(myResultText.data(), myResultText.size());
+                }
             }
+            writer.Raw('}');
+        }
 
-            switch (static_cast<Fault::ReservedCodes>(myFaultCode)) {
-            case Fault::RESERVED_CODE_MIN:
-            case Fault::RESERVED_CODE_MAX:
-            case Fault::SERVER_ERROR_CODE_MIN:
-            case Fault::SERVER_ERROR_CODE_DEFAULT:
-                break;
-            case Fault::PARSE_ERROR:
-                throw ParseErrorFault(myFaultString);
-            case Fault::INVALID_REQUEST:
-                throw InvalidRequestFault(myFaultString);
-            case Fault::METHOD_NOT_FOUND:
-                throw MethodNotFoundFault(myFaultString);
-            case Fault::INVALID_PARAMETERS:
-                throw InvalidParametersFault(myFaultString);
-            case Fault::INTERNAL_ERROR:
-                throw InternalErrorFault(myFaultString);
+        // Parses the result text once, if it has one
+        Json& GetResult() {
+            if (!myResultText.empty()) {
+                myResult = ParseResultText();
+                myResultText.clear();
             }
+            return myResult;
+        }
 
-            if (myFaultCode >= Fault::SERVER_ERROR_CODE_MIN
-                && myFaultCode <= Fault::SERVER_ERROR_CODE_MAX) {
-                throw ServerErrorFault(myFaultCode, myFaultString);
-            }
+        bool IsFault() const { return myIsFault; }
+        int32_t GetFaultCode() const { return myFaultCode; }
+        const std::string& GetFaultString() const { return myFaultString; }
 
-            if (myFaultCode >= Fault::RESERVED_CODE_MIN
-                && myFaultCode <= Fault::RESERVED_CODE_MAX) {
-                throw PreDefinedFault(myFaultCode, myFaultString);
+        void ThrowIfFault() const {
+            if (IsFault()) {
+                Fault::Throw(myFaultCode, myFaultString);
             }
-
-            throw Fault(myFaultString, myFaultCode);
         }
 
         const Json& GetId() const { return myId; }
 
     private:
+        Json ParseResultText() const {
+            std::string err;
+            return Json::parse(myResultText, err);
+        }
+
         Json myResult;
+        std::string myResultText;
         bool myIsFault;
         int myFaultCode;
         std::string myFaultString;
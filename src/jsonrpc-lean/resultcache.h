@@ -0,0 +1,184 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_RESULTCACHE_H
+#define JSONRPC_LEAN_RESULTCACHE_H
+
+#include "json.h"
+#include "request.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace jsonrpc {
+
+    // The JSON text of the results of a method, by the text of its
+    // parameters, see MethodWrapper::SetCacheable(). It is split in shards
+    // of their own lock, each one evicting its least recently used result
+    // once full and ignoring results older than the time to live.
+    class ResultCache {
+    public:
+        typedef std::chrono::steady_clock Clock;
+
+        // A ttl of 0 keeps results until they are evicted
+        ResultCache(size_t maxEntries, Clock::duration ttl)
+            : myShards(maxEntries < MIN_ENTRIES_SHARDED ? 1 : SHARDS), myTtl(ttl) {
+            for (auto& shard : myShards) {
+                shard.maxEntries = std::max<size_t>(1, maxEntries / myShards.size());
+            }
+        }
+
+        ResultCache(const ResultCache&) = delete;
+        ResultCache& operator=(const ResultCache&) = delete;
+
+        size_t GetMaxEntries() const { return myShards.size() * myShards.front().maxEntries; }
+        Clock::duration GetTtl() const { return myTtl; }
+
+        // The key of a call, its params array without the whitespace between
+        // the values: calls only differing by their layout share a result
+        static std::string GetKey(StringRef params) {
+            std::string key;
+            AppendCompact(params, key);
+            return key;
+        }
+
+        // Same for parameters that were parsed already
+        static std::string GetKey(const Request::Parameters& params) {
+            std::string key(1, '[');
+            std::string value;
+            for (auto& param : params) {
+                if (key.size() > 1) {
+                    key += ',';
+                }
+                value.clear();
+                param.dump(value);
+                AppendCompact(value, key);
+            }
+            key += ']';
+            return key;
+        }
+
+        // Null when there is none or it expired
+        std::shared_ptr<const std::string> Find(const std::string& key) {
+            Shard& shard = GetShard(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.entries.find(key);
+            if (found == shard.entries.end()) {
+                return nullptr;
+            }
+            auto entry = found->second;
+            if (IsExpired(*entry)) {
+                shard.lru.erase(entry);
+                shard.entries.erase(found);
+                return nullptr;
+            }
+            // most recently used first
+            shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+            return entry->result;
+        }
+
+        void Insert(std::string key, std::string result) {
+            auto shared = std::make_shared<const std::string>(std::move(result));
+            const Clock::time_point time = myTtl == Clock::duration::zero() ? Clock::time_point() : Clock::now();
+            Shard& shard = GetShard(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto inserted = shard.entries.emplace(std::move(key), shard.lru.end());
+            if (!inserted.second) {
+                // another thread called the method with the same parameters
+                auto entry = inserted.first->second;
+                entry->result = std::move(shared);
+                entry->time = time;
+                shard.lru.splice(shard.lru.begin(), shard.lru, entry);
+                return;
+            }
+            shard.lru.push_front(Entry{ &inserted.first->first, std::move(shared), time });
+            inserted.first->second = shard.lru.begin();
+            if (shard.entries.size() > shard.maxEntries) {
+                // found first, the key belongs to the node being erased
+                auto last = shard.entries.find(*shard.lru.back().key);
+                shard.entries.erase(last);
+                shard.lru.pop_back();
+            }
+        }
+
+        void Clear() {
+            for (auto& shard : myShards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                shard.entries.clear();
+                shard.lru.clear();
+            }
+        }
+
+        size_t GetSize() const {
+            size_t size = 0;
+            for (auto& shard : myShards) {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+                size += shard.entries.size();
+            }
+            return size;
+        }
+
+    private:
+        static const size_t SHARDS = 16;
+        // smaller caches are not worth splitting
+        static const size_t MIN_ENTRIES_SHARDED = 256;
+
+        struct Entry {
+            const std::string* key;
+            std::shared_ptr<const std::string> result;
+            Clock::time_point time;
+        };
+
+        struct Shard {
+            mutable std::mutex mutex;
+            size_t maxEntries = 1;
+            std::list<Entry> lru;
+            std::unordered_map<std::string, std::list<Entry>::iterator> entries;
+        };
+
+        // Skips the whitespace outside of the strings of valid JSON text
+        static void AppendCompact(StringRef text, std::string& out) {
+            out.reserve(out.size() + text.size());
+            bool inString = false;
+            for (size_t i = 0; i < text.size(); ++i) {
+                const char c = text[i];
+                if (inString) {
+                    out += c;
+                    if (c == '\\' && i + 1 < text.size()) {
+                        out += text[++i];
+                    } else if (c == '"') {
+                        inString = false;
+                    }
+                } else if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+                    out += c;
+                    inString = c == '"';
+                }
+            }
+        }
+
+        Shard& GetShard(const std::string& key) {
+            if (myShards.size() == 1) {
+                return myShards.front();
+            }
+            // the upper bits, the map buckets use the lower ones
+            return myShards[(std::hash<std::string>()(key) >> 20) % myShards.size()];
+        }
+
+        bool IsExpired(const Entry& entry) const {
+            return myTtl != Clock::duration::zero() && Clock::now() - entry.time >= myTtl;
+        }
+
+        std::vector<Shard> myShards;
+        const Clock::duration myTtl;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_RESULTCACHE_H
@@ -0,0 +1,97 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_RESULTWRITER_H
+#define JSONRPC_LEAN_RESULTWRITER_H
+
+#include "json.h"
+#include "jsonwriter.h"
+
+#include <string>
+#include <type_traits>
+
+namespace jsonrpc {
+
+    // Writes a method result of type T as JSON, with the same text Json(value)
+    // would dump to. Types without a specialization go through Json.
+    template<typename T, typename Enable = void>
+    struct ResultWriter {
+        static void Write(JsonWriter& writer, const T& value) {
+            writer.Value(Json(value));
+        }
+    };
+
+    // Integers Json stores as int, the others would be ambiguous for it
+    template<typename T>
+    struct ResultWriter<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value
+        && (sizeof(T) < sizeof(int) || std::is_same<T, int>::value)>::type> {
+        static void Write(JsonWriter& writer, T value) {
+            writer.Int(value);
+        }
+    };
+
+    template<typename T>
+    struct ResultWriter<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+        static void Write(JsonWriter& writer, T value) {
+            writer.Double(value);
+        }
+    };
+
+    template<>
+    struct ResultWriter<bool> {
+        static void Write(JsonWriter& writer, bool value) {
+            writer.Bool(value);
+        }
+    };
+
+    template<>
+    struct ResultWriter<std::string> {
+        static void Write(JsonWriter& writer, const std::string& value) {
+            writer.String(value);
+        }
+    };
+
+    template<>
+    struct ResultWriter<Json> {
+        static void Write(JsonWriter& writer, const Json& value) {
+            writer.Value(value);
+        }
+    };
+
+    template<>
+    struct ResultWriter<Json::array> {
+        static void Write(JsonWriter& writer, const Json::array& value) {
+            writer.Raw('[');
+            bool first = true;
+            for (auto& element : value) {
+                if (!first) {
+                    writer.Raw(", ", 2);
+                }
+                writer.Value(element);
+                first = false;
+            }
+            writer.Raw(']');
+        }
+    };
+
+    template<>
+    struct ResultWriter<Json::object> {
+        static void Write(JsonWriter& writer, const Json::object& value) {
+            writer.Raw('{');
+            bool first = true;
+            for (auto& member : value) {
+                if (!first) {
+                    writer.Raw(", ", 2);
+                }
+                writer.String(member.first);
+                writer.Raw(": ", 2);
+                writer.Value(member.second);
+                first = false;
+            }
+            writer.Raw('}');
+        }
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_RESULTWRITER_H
@@ -20,14 +20,20 @@
 #ifndef JSONRPC_LEAN_SERVER_H
 #define JSONRPC_LEAN_SERVER_H
 
+#include "arena.h"
 #include "request.h"
 #include "fault.h"
 #include "response.h"
 #include "dispatcher.h"
 #include "jsonreader.h"
+#include "threadpool.h"
+#include "tracer.h"
 
-
+#include <atomic>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace jsonrpc {
 
@@ -44,27 +50,276 @@ namespace jsonrpc {
 
         Dispatcher& GetDispatcher() { return *myDispatcherPtr; }
 
-        // If aRequestData is a Notification (the client doesn't expect a response), the returned FormattedData will have an empty ->GetData() buffer and ->GetSize() will be 0
+        // If aRequestData is a Notification (the client doesn't expect a response), the returned string is empty
+        // A batch (top level array) is answered with one array holding the responses of all non-notification calls
         std::string HandleRequest(const std::string& aRequestData) {
-            Json responseJson;
+            std::string response;
+            HandleRequest(aRequestData, response);
+            return response;
+        }
 
-            try {
-                auto reader = JsonReader(aRequestData);
-                Request request = reader.GetRequest();
+        // Appends the response to aResponseData, so a transport can reuse one buffer per connection.
+        // Nothing is appended for notifications.
+        void HandleRequest(const std::string& aRequestData, std::string& aResponseData) {
+            HandleRequest(StringRef(aRequestData), aResponseData);
+        }
 
-                auto response = myDispatcherPtr->Invoke(request.GetMethodName(), request.GetParameters(), request.GetId());
-                if (!response.GetId().is_bool() || response.GetId().bool_value() != false) {
-                    // if Id is false, this is a notification and we don't have to write a response
-                    responseJson = response.Write();
+        // Same, for a request that is not in a string of its own, e.g. one
+        // handed over by a StreamParser
+        void HandleRequest(StringRef aRequestData, std::string& aResponseData) {
+            ArenaScope arena(myUseArena ? &Arena::GetThreadArena() : nullptr);
+            TraceScope parse(myTracer.get(), Tracer::PARSE);
+            // invalid input is common enough not to be thrown around
+            auto reader = JsonReader::Read(aRequestData);
+            if (!reader) {
+                parse.End();
+                WriteFault(reader, aResponseData);
+                return;
+            }
+            if (reader->IsBatch()) {
+                auto batch = reader->ReadBatch();
+                parse.End();
+                if (!batch) {
+                    WriteFault(batch, aResponseData);
+                    return;
                 }
-            } catch (const Fault& ex) {
-                responseJson = Response(ex.GetCode(), ex.GetString(), Json()).Write();
+                HandleBatch(std::move(*batch), aResponseData);
+                return;
+            }
+            HandleReader(*reader, aResponseData, std::move(parse));
+        }
+
+        // Like HandleRequest, but hands the response to done once every
+        // method has completed, which may be after this returns and on
+        // another thread when asynchronous methods are called. done gets an
+        // empty string for notifications. aRequestData can go away as soon
+        // as this returns.
+        void HandleRequestAsync(const std::string& aRequestData, std::function<void(std::string)> done) {
+            HandleRequestAsync(StringRef(aRequestData), std::move(done));
+        }
+
+        void HandleRequestAsync(StringRef aRequestData, std::function<void(std::string)> done) {
+            ArenaScope arena(myUseArena ? &Arena::GetThreadArena() : nullptr);
+            TraceScope parse(myTracer.get(), Tracer::PARSE);
+            auto reader = JsonReader::Read(aRequestData);
+            if (!reader) {
+                parse.End();
+                std::string response;
+                WriteFault(reader, response);
+                done(std::move(response));
+                return;
+            }
+            if (reader->IsBatch()) {
+                auto batch = reader->ReadBatch();
+                parse.End();
+                if (!batch) {
+                    std::string response;
+                    WriteFault(batch, response);
+                    done(std::move(response));
+                    return;
+                }
+                HandleBatchAsync(*batch, std::move(done));
+                return;
+            }
+            HandleReaderAsync(*reader, std::move(done), std::move(parse));
+        }
+
+        // Takes the parameters of a request and their intermediate copies from
+        // an arena of the handling thread, released once HandleRequest returns.
+        // Methods must then not keep the Request::Parameters they are given
+        // other than by copy.
+        void SetRequestArena(bool enabled = true) {
+            myUseArena = enabled;
+        }
+
+        // Runs the elements of a batch request on up to threads threads (including the caller),
+        // 0 or 1 dispatches them one after the other on the calling thread.
+        // All methods must be safe to call concurrently when this is enabled.
+        void SetBatchConcurrency(size_t threads) {
+            if (threads > 1) {
+                myBatchPool.reset(new ThreadPool(threads - 1));
+            } else {
+                myBatchPool.reset();
+            }
+        }
+
+        // Calls tracer around the parse, dispatch and serialize stages of
+        // every request, until it is replaced by another one or nullptr.
+        // Must not be called while requests are being handled.
+        void SetTracer(std::shared_ptr<Tracer> tracer) {
+            myTracer = std::move(tracer);
+        }
+
+    private:
+        // Returns false when nothing was written
+        // parse is the stage that ends with the request read
+        bool HandleReader(JsonReader& reader, std::string& out, TraceScope parse) const {
+            auto request = reader.ReadRequest();
+            if (!request) {
+                parse.End();
+                WriteFault(request, out);
+                return true;
             }
+            parse.SetRequest(request->GetId(), request->GetMethodName());
+            parse.End();
 
-            return std::move(responseJson.dump());
+            Tracer* tracer = myTracer.get();
+            TraceScope dispatch(tracer, Tracer::DISPATCH, request->GetId(), request->GetMethodName());
+            auto response = myDispatcherPtr->Invoke(*request);
+            dispatch.End();
+            if (IsNotification(response)) {
+                return false;
+            }
+            TraceScope serialize(tracer, Tracer::SERIALIZE, request->GetId(), request->GetMethodName());
+            response.Write(out);
+            return true;
         }
+
+        bool HandleReader(JsonReader& reader, std::string& out) const {
+            return HandleReader(reader, out, TraceScope(myTracer.get(), Tracer::PARSE));
+        }
+
+        void HandleReaderAsync(JsonReader& reader, std::function<void(std::string)> done, TraceScope parse) const {
+            auto request = reader.ReadRequest();
+            if (!request) {
+                parse.End();
+                std::string response;
+                WriteFault(request, response);
+                done(std::move(response));
+                return;
+            }
+            parse.SetRequest(request->GetId(), request->GetMethodName());
+            parse.End();
+
+            if (!myTracer) {
+                myDispatcherPtr->InvokeAsync(*request, [done](Response response) {
+                    std::string out;
+                    if (!IsNotification(response)) {
+                        response.Write(out);
+                    }
+                    done(std::move(out));
+                });
+                return;
+            }
+
+            // the dispatch stage ends with the method, after the request is gone
+            std::shared_ptr<Tracer> tracer = myTracer;
+            auto method = std::make_shared<std::string>(request->GetMethodName());
+            Json id = request->GetId();
+            Tracer::Clock::time_point start = Tracer::Clock::now();
+            tracer->Begin(Tracer::DISPATCH, id, *method);
+            myDispatcherPtr->InvokeAsync(*request, [done, tracer, method, id, start](Response response) {
+                tracer->End(Tracer::DISPATCH, id, *method, start);
+                std::string out;
+                if (!IsNotification(response)) {
+                    TraceScope serialize(tracer.get(), Tracer::SERIALIZE, id, *method);
+                    response.Write(out);
+                }
+                done(std::move(out));
+            });
+        }
+
+        void HandleReaderAsync(JsonReader& reader, std::function<void(std::string)> done) const {
+            HandleReaderAsync(reader, std::move(done), TraceScope(myTracer.get(), Tracer::PARSE));
+        }
+
+        static bool IsNotification(const Response& response) {
+            // if Id is false, this is a notification and we don't have to write a response
+            return response.GetId().is_bool() && response.GetId().bool_value() == false;
+        }
+
+        template<typename T>
+        static void WriteFault(const Expected<T>& fault, std::string& out) {
+            Response(fault.GetFaultCode(), fault.GetFaultString(), Json()).Write(out);
+        }
+
+        // The responses of a batch request, written out together
+        struct BatchWriter {
+            explicit BatchWriter(std::string& out) : out(out), start(out.size()), empty(true) {
+                out += '[';
+            }
+
+            void Append(const std::string& response) {
+                if (!response.empty()) {
+                    if (!empty) {
+                        out.append(", ", 2);
+                    }
+                    out += response;
+                    empty = false;
+                }
+            }
+
+            // notifications are not answered, and neither is a batch made only of them
+            void Close() {
+                if (empty) {
+                    out.resize(start);
+                } else {
+                    out += ']';
+                }
+            }
+
+            std::string& out;
+            size_t start;
+            bool empty;
+        };
+
+        void HandleBatch(std::vector<JsonReader> batch, std::string& out) const {
+            BatchWriter writer(out);
+
+            if (myBatchPool && batch.size() > 1) {
+                std::vector<std::string> responses(batch.size());
+                myBatchPool->ParallelFor(batch.size(), [&](size_t i) {
+                    ArenaScope arena(myUseArena ? &Arena::GetThreadArena() : nullptr);
+                    HandleReader(batch[i], responses[i]);
+                });
+                for (auto& response : responses) {
+                    writer.Append(response);
+                }
+            } else {
+                std::string response;
+                for (auto& reader : batch) {
+                    response.clear();
+                    HandleReader(reader, response);
+                    writer.Append(response);
+                }
+            }
+
+            writer.Close();
+        }
+
+        void HandleBatchAsync(std::vector<JsonReader>& batch, std::function<void(std::string)> done) const {
+            struct State {
+                std::vector<std::string> responses;
+                std::atomic<size_t> remaining;
+                std::function<void(std::string)> done;
+            };
+            auto state = std::make_shared<State>();
+            state->responses.resize(batch.size());
+            state->remaining = batch.size();
+            state->done = std::move(done);
+
+            for (size_t i = 0; i < batch.size(); ++i) {
+                HandleReaderAsync(batch[i], [state, i](std::string response) {
+                    state->responses[i] = std::move(response);
+                    // the last one to complete writes the whole batch
+                    if (--state->remaining == 0) {
+                        std::string out;
+                        BatchWriter writer(out);
+                        for (auto& element : state->responses) {
+                            writer.Append(element);
+                        }
+                        writer.Close();
+                        state->done(std::move(out));
+                    }
+                });
+            }
+        }
+
     private:
         std::unique_ptr<Dispatcher> myDispatcherPtr;
+        std::unique_ptr<ThreadPool> myBatchPool;
+        bool myUseArena = false;
+        std::shared_ptr<Tracer> myTracer;
     };
 
 } // namespace jsonrpc
@@ -0,0 +1,391 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_SMALLVECTOR_H
+#define JSONRPC_LEAN_SMALLVECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace jsonrpc {
+
+    // Contiguous vector keeping its first N elements inside the object, so
+    // the usual short parameter lists never allocate. Beyond that it grows
+    // through Allocator like std::vector. Copies use the allocator returned by
+    // select_on_container_copy_construction, and swap() exchanges allocators
+    // under propagate_on_container_swap, as standard containers do.
+    template<typename T, size_t N, typename Allocator = std::allocator<T>>
+    class SmallVector {
+        static_assert(N > 0, "SmallVector needs inline room for at least one element");
+        typedef std::allocator_traits<Allocator> AllocatorTraits;
+
+    public:
+        typedef T value_type;
+        typedef Allocator allocator_type;
+        typedef size_t size_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef T& reference;
+        typedef const T& const_reference;
+        typedef T* pointer;
+        typedef const T* const_pointer;
+        typedef T* iterator;
+        typedef const T* const_iterator;
+        typedef std::reverse_iterator<iterator> reverse_iterator;
+        typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+        SmallVector() : SmallVector(Allocator()) {}
+
+        explicit SmallVector(const Allocator& allocator)
+            : myAllocator(allocator), myData(Inline()), mySize(0), myCapacity(N) {
+        }
+
+        explicit SmallVector(size_t count, const T& value = T(), const Allocator& allocator = Allocator())
+            : SmallVector(allocator) {
+            resize(count, value);
+        }
+
+        SmallVector(std::initializer_list<T> init, const Allocator& allocator = Allocator())
+            : SmallVector(allocator) {
+            insert(end(), init.begin(), init.end());
+        }
+
+        template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+        SmallVector(InputIt first, InputIt last, const Allocator& allocator = Allocator())
+            : SmallVector(allocator) {
+            insert(end(), first, last);
+        }
+
+        SmallVector(const SmallVector& other)
+            : SmallVector(other, AllocatorTraits::select_on_container_copy_construction(other.myAllocator)) {
+        }
+
+        SmallVector(const SmallVector& other, const Allocator& allocator)
+            : SmallVector(allocator) {
+            insert(end(), other.begin(), other.end());
+        }
+
+        SmallVector(SmallVector&& other) noexcept
+            : myAllocator(std::move(other.myAllocator)), myData(Inline()), mySize(0), myCapacity(N) {
+            Steal(other);
+        }
+
+        ~SmallVector() {
+            clear();
+            Release();
+        }
+
+        SmallVector& operator=(const SmallVector& other) {
+            if (this != &other) {
+                assign(other.begin(), other.end());
+            }
+            return *this;
+        }
+
+        // Moves the elements one by one, which may throw, when the storage
+        // of other cannot be released through our allocator
+        SmallVector& operator=(SmallVector&& other) {
+            if (this != &other) {
+                clear();
+                if (myAllocator == other.myAllocator) {
+                    Release();
+                    Steal(other);
+                } else {
+                    for (auto& value : other) {
+                        emplace_back(std::move(value));
+                    }
+                    other.clear();
+                }
+            }
+            return *this;
+        }
+
+        SmallVector& operator=(std::initializer_list<T> init) {
+            assign(init.begin(), init.end());
+            return *this;
+        }
+
+        template<typename InputIt>
+        void assign(InputIt first, InputIt last) {
+            clear();
+            insert(end(), first, last);
+        }
+
+        allocator_type get_allocator() const { return myAllocator; }
+
+        // Capacity
+        bool empty() const { return mySize == 0; }
+        size_t size() const { return mySize; }
+        size_t capacity() const { return myCapacity; }
+
+        void reserve(size_t capacity) {
+            if (capacity > myCapacity) {
+                Reallocate(capacity);
+            }
+        }
+
+        // Element access
+        T* data() { return myData; }
+        const T* data() const { return myData; }
+
+        T& operator[](size_t i) { return myData[i]; }
+        const T& operator[](size_t i) const { return myData[i]; }
+
+        T& at(size_t i) {
+            if (i >= mySize) {
+                throw std::out_of_range("SmallVector::at");
+            }
+            return myData[i];
+        }
+        const T& at(size_t i) const {
+            return const_cast<SmallVector*>(this)->at(i);
+        }
+
+        T& front() { return myData[0]; }
+        const T& front() const { return myData[0]; }
+        T& back() { return myData[mySize - 1]; }
+        const T& back() const { return myData[mySize - 1]; }
+
+        // Iterators
+        iterator begin() { return myData; }
+        const_iterator begin() const { return myData; }
+        const_iterator cbegin() const { return myData; }
+        iterator end() { return myData + mySize; }
+        const_iterator end() const { return myData + mySize; }
+        const_iterator cend() const { return myData + mySize; }
+        reverse_iterator rbegin() { return reverse_iterator(end()); }
+        const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+        reverse_iterator rend() { return reverse_iterator(begin()); }
+        const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+
+        // Modifiers
+        void clear() {
+            for (size_t i = 0; i < mySize; ++i) {
+                myData[i].~T();
+            }
+            mySize = 0;
+        }
+
+        void push_back(const T& value) { emplace_back(value); }
+        void push_back(T&& value) { emplace_back(std::move(value)); }
+
+        template<typename... Args>
+        T& emplace_back(Args&&... args) {
+            if (mySize == myCapacity) {
+                // args may refer to an element, construct before moving the others
+                const size_t capacity = 2 * myCapacity;
+                T* data = AllocatorTraits::allocate(myAllocator, capacity);
+                ::new (static_cast<void*>(data + mySize)) T(std::forward<Args>(args)...);
+                MoveTo(data, capacity);
+            } else {
+                ::new (static_cast<void*>(myData + mySize)) T(std::forward<Args>(args)...);
+            }
+            return myData[mySize++];
+        }
+
+        void pop_back() {
+            myData[--mySize].~T();
+        }
+
+        void resize(size_t size) {
+            resize(size, T());
+        }
+
+        void resize(size_t size, const T& value) {
+            if (size < mySize) {
+                erase(begin() + size, end());
+                return;
+            }
+            if (size > myCapacity) {
+                // value may be an element, which reserve() moves away
+                const T copy(value);
+                reserve(size);
+                Fill(size, copy);
+                return;
+            }
+            Fill(size, value);
+        }
+
+        iterator insert(const_iterator position, const T& value) {
+            // value may be an element, which opening the gap moves
+            T copy(value);
+            return insert(position, std::make_move_iterator(&copy), std::make_move_iterator(&copy + 1));
+        }
+
+        template<typename InputIt, typename = typename std::iterator_traits<InputIt>::iterator_category>
+        iterator insert(const_iterator position, InputIt first, InputIt last) {
+            const size_t offset = position - begin();
+            const size_t count = std::distance(first, last);
+            if (count == 0) {
+                return begin() + offset;
+            }
+            if (mySize + count > myCapacity) {
+                // [first, last) may be part of this vector, fill the new
+                // storage in order while the old one is still intact
+                const size_t capacity = std::max(mySize + count, 2 * myCapacity);
+                T* data = AllocatorTraits::allocate(myAllocator, capacity);
+                for (size_t i = 0; i < count; ++i, ++first) {
+                    ::new (static_cast<void*>(data + offset + i)) T(*first);
+                }
+                for (size_t i = offset; i < mySize; ++i) {
+                    ::new (static_cast<void*>(data + count + i)) T(std::move(myData[i]));
+                    myData[i].~T();
+                }
+                const size_t size = mySize + count;
+                mySize = offset;
+                MoveTo(data, capacity);
+                mySize = size;
+                return begin() + offset;
+            }
+
+            if (Contains(first)) {
+                // opening the gap would overwrite [first, last)
+                const SmallVector copy(first, last, myAllocator);
+                return insert(position, copy.begin(), copy.end());
+            }
+
+            // open a gap of count elements at offset, then fill it
+            const size_t tail = mySize - offset;
+            for (size_t i = mySize; i > offset; --i) {
+                const size_t to = i - 1 + count;
+                if (to >= mySize) {
+                    ::new (static_cast<void*>(myData + to)) T(std::move(myData[i - 1]));
+                } else {
+                    myData[to] = std::move(myData[i - 1]);
+                }
+            }
+            T* out = myData + offset;
+            for (size_t i = 0; i < count; ++i, ++first, ++out) {
+                if (i < tail) {
+                    *out = *first;
+                } else {
+                    ::new (static_cast<void*>(out)) T(*first);
+                }
+            }
+            mySize += count;
+            return begin() + offset;
+        }
+
+        iterator erase(const_iterator position) {
+            return erase(position, position + 1);
+        }
+
+        iterator erase(const_iterator first, const_iterator last) {
+            T* to = myData + (first - myData);
+            T* from = myData + (last - myData);
+            if (to != from) {
+                T* newEnd = std::move(from, end(), to);
+                while (end() != newEnd) {
+                    pop_back();
+                }
+            }
+            return to;
+        }
+
+        void swap(SmallVector& other) {
+            if (this != &other) {
+                Swap(other, typename AllocatorTraits::propagate_on_container_swap());
+            }
+        }
+
+        friend void swap(SmallVector& a, SmallVector& b) { a.swap(b); }
+
+        bool operator==(const SmallVector& other) const {
+            return mySize == other.mySize && std::equal(begin(), end(), other.begin());
+        }
+        bool operator!=(const SmallVector& other) const { return !(*this == other); }
+
+    private:
+        T* Inline() { return reinterpret_cast<T*>(&myInline); }
+        bool IsInline() const { return myData == reinterpret_cast<const T*>(&myInline); }
+
+        // Whether an iterator points into the elements, only known for pointers
+        bool Contains(const T* element) const {
+            return std::greater_equal<const T*>()(element, myData) && std::less<const T*>()(element, myData + mySize);
+        }
+        bool Contains(T* element) const { return Contains(const_cast<const T*>(element)); }
+        template<typename InputIt>
+        bool Contains(const InputIt&) const { return false; }
+
+        // Appends copies of value up to size, the room is reserved already
+        void Fill(size_t size, const T& value) {
+            while (mySize < size) {
+                ::new (static_cast<void*>(myData + mySize)) T(value);
+                ++mySize;
+            }
+        }
+
+        void Reallocate(size_t capacity) {
+            MoveTo(AllocatorTraits::allocate(myAllocator, capacity), capacity);
+        }
+
+        // Moves the elements to data and makes it the storage
+        void MoveTo(T* data, size_t capacity) {
+            for (size_t i = 0; i < mySize; ++i) {
+                ::new (static_cast<void*>(data + i)) T(std::move(myData[i]));
+                myData[i].~T();
+            }
+            Release();
+            myData = data;
+            myCapacity = capacity;
+        }
+
+        void Release() {
+            if (!IsInline()) {
+                AllocatorTraits::deallocate(myAllocator, myData, myCapacity);
+                myData = Inline();
+                myCapacity = N;
+            }
+        }
+
+        // The allocators go along with the storage
+        void Swap(SmallVector& other, std::true_type) {
+            SmallVector taken(std::move(other));
+            other.myAllocator = myAllocator;
+            other.Steal(*this);
+            myAllocator = taken.myAllocator;
+            Steal(taken);
+        }
+
+        // Each keeps its allocator, the elements are moved when they differ
+        void Swap(SmallVector& other, std::false_type) {
+            SmallVector taken(std::move(other));
+            other = std::move(*this);
+            *this = std::move(taken);
+        }
+
+        // Takes the elements of other, and its storage when it is on the heap
+        void Steal(SmallVector& other) {
+            if (other.IsInline()) {
+                for (size_t i = 0; i < other.mySize; ++i) {
+                    ::new (static_cast<void*>(Inline() + i)) T(std::move(other.myData[i]));
+                }
+                mySize = other.mySize;
+                other.clear();
+            } else {
+                myData = other.myData;
+                mySize = other.mySize;
+                myCapacity = other.myCapacity;
+                other.myData = other.Inline();
+                other.mySize = 0;
+                other.myCapacity = N;
+            }
+        }
+
+        Allocator myAllocator;
+        T* myData;
+        size_t mySize;
+        size_t myCapacity;
+        typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type myInline;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_SMALLVECTOR_H
@@ -0,0 +1,437 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_SOCKETSERVER_H
+#define JSONRPC_LEAN_SOCKETSERVER_H
+
+#include "framing.h"
+#include "server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace jsonrpc {
+
+    // Serves a Server over TCP and Unix domain sockets, with framed
+    // messages (see framing.h). Each event loop is a thread with its own
+    // epoll instance, watching its connections edge-triggered. Requests are
+    // handled on the loop thread, so methods must not block for long and,
+    // with several loops, must be safe to call concurrently.
+    //
+    // A connection whose peer does not read its responses stops being read
+    // once SetMaxPendingOutput() bytes are waiting to be written, and is
+    // read again when half of them are written.
+    class SocketServer {
+    public:
+        explicit SocketServer(Server& server, Framing framing = Framing::NEWLINE_DELIMITED)
+            : myServer(server), myFraming(framing), myLoopCount(1), myReusePort(true),
+            myMaxPendingOutput(1 << 20), myMaxMessageSize(0), myTcpPort(0) {
+            myStopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+            if (myStopFd < 0) {
+                throw std::system_error(errno, std::system_category(), "eventfd");
+            }
+        }
+
+        ~SocketServer() {
+            Stop();
+            for (auto& thread : myThreads) {
+                thread.join();
+            }
+            for (auto& listener : myListeners) {
+                close(listener.fd);
+            }
+            for (auto& path : myUnixPaths) {
+                unlink(path.c_str());
+            }
+            close(myStopFd);
+        }
+
+        SocketServer(const SocketServer&) = delete;
+        SocketServer& operator=(const SocketServer&) = delete;
+
+        // Serves the connections on loops event loops. With reusePort and
+        // several loops, each loop gets a TCP listening socket of its own
+        // bound with SO_REUSEPORT, and the kernel spreads the connections
+        // over them. Otherwise the loops share the listening sockets. Call
+        // it before listening.
+        void SetLoops(size_t loops, bool reusePort = true) {
+            myLoopCount = loops > 0 ? loops : 1;
+            myReusePort = reusePort;
+        }
+
+        // Backpressure threshold of a connection, in bytes
+        void SetMaxPendingOutput(size_t bytes) { myMaxPendingOutput = bytes; }
+
+        // Connections sending larger messages are closed, 0 for no limit
+        void SetMaxMessageSize(size_t bytes) { myMaxMessageSize = bytes; }
+
+        // Port 0 picks a free port, see GetTcpPort()
+        void ListenTcp(const std::string& address, uint16_t port) {
+            sockaddr_in addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(port);
+            if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+                throw std::invalid_argument(address + ": not an IPv4 address");
+            }
+
+            // a single socket does not let other processes bind the port
+            const bool reusePort = myReusePort && myLoopCount > 1;
+            const size_t sockets = reusePort ? myLoopCount : 1;
+            for (size_t i = 0; i < sockets; ++i) {
+                const int fd = CreateSocket(AF_INET);
+                const int enable = 1;
+                setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+                if (reusePort && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+                    CloseAndThrow(fd, "SO_REUSEPORT");
+                }
+                if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+                    CloseAndThrow(fd, "bind");
+                }
+                Listen(fd, i, sockets == 1);
+                if (addr.sin_port == 0) {
+                    // the other sockets take the port picked for the first one
+                    socklen_t size = sizeof(addr);
+                    getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &size);
+                }
+            }
+            myTcpPort = ntohs(addr.sin_port);
+        }
+
+        // An existing socket file at path is replaced
+        void ListenUnix(const std::string& path) {
+            sockaddr_un addr;
+            memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(addr.sun_path)) {
+                throw std::invalid_argument(path + ": path too long");
+            }
+            memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+            const int fd = CreateSocket(AF_UNIX);
+            unlink(path.c_str());
+            if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+                CloseAndThrow(fd, "bind");
+            }
+            myUnixPaths.push_back(path);
+            Listen(fd, myListeners.size(), true);
+        }
+
+        uint16_t GetTcpPort() const { return myTcpPort; }
+
+        // Serves until Stop(), the first loop runs on the calling thread
+        void Run() {
+            std::vector<std::unique_ptr<Loop>> loops;
+            for (size_t i = 0; i < myLoopCount; ++i) {
+                loops.emplace_back(new Loop(*this, i));
+            }
+            for (size_t i = 1; i < loops.size(); ++i) {
+                Loop* loop = loops[i].get();
+                myThreads.emplace_back([loop] { loop->Run(); });
+            }
+            loops[0]->Run();
+            for (auto& thread : myThreads) {
+                thread.join();
+            }
+            myThreads.clear();
+        }
+
+        // Can be called from any thread, or from a method
+        void Stop() {
+            const uint64_t one = 1;
+            ssize_t written = write(myStopFd, &one, sizeof(one));
+            (void)written;
+        }
+
+    private:
+        struct Listener {
+            int fd;
+            // the loop serving it, or all of them when shared
+            size_t loop;
+            bool shared;
+        };
+
+        struct Connection {
+            Connection(int fd, Framing framing, size_t maxMessageSize)
+                : fd(fd), reader(framing, maxMessageSize), writer(framing), paused(false), closing(false) {
+            }
+
+            int fd;
+            FrameReader reader;
+            FrameWriter writer;
+            bool paused;
+            bool closing;
+        };
+
+        class Loop {
+        public:
+            Loop(SocketServer& owner, size_t index) : myOwner(owner), myIndex(index) {
+                myEpoll = epoll_create1(EPOLL_CLOEXEC);
+                if (myEpoll < 0) {
+                    throw std::system_error(errno, std::system_category(), "epoll_create1");
+                }
+                myReserveFd = OpenReserve();
+            }
+
+            ~Loop() {
+                for (auto& connection : myConnections) {
+                    close(connection.first);
+                }
+                if (myReserveFd >= 0) {
+                    close(myReserveFd);
+                }
+                close(myEpoll);
+            }
+
+            void Run() {
+                Watch(myOwner.myStopFd, EPOLLIN);
+                for (auto& listener : myOwner.myListeners) {
+                    if (listener.shared || listener.loop == myIndex) {
+                        WatchListener(listener);
+                    }
+                }
+
+                epoll_event events[256];
+                for (;;) {
+                    const int count = epoll_wait(myEpoll, events, 256, -1);
+                    if (count < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        return;
+                    }
+                    for (int i = 0; i < count; ++i) {
+                        const int fd = events[i].data.fd;
+                        if (fd == myOwner.myStopFd) {
+                            // left readable, so that it stops every loop
+                            return;
+                        }
+                        auto connection = myConnections.find(fd);
+                        if (connection != myConnections.end()) {
+                            OnEvent(*connection->second, events[i].events);
+                        } else {
+                            Accept(fd);
+                        }
+                    }
+                }
+            }
+
+        private:
+            void Watch(int fd, uint32_t events) {
+                epoll_event event;
+                memset(&event, 0, sizeof(event));
+                event.events = events;
+                event.data.fd = fd;
+                epoll_ctl(myEpoll, EPOLL_CTL_ADD, fd, &event);
+            }
+
+            void WatchListener(const Listener& listener) {
+#ifdef EPOLLEXCLUSIVE
+                if (listener.shared) {
+                    // only one of the loops is woken up by a connection
+                    Watch(listener.fd, EPOLLIN | EPOLLEXCLUSIVE);
+                    return;
+                }
+#endif
+                Watch(listener.fd, EPOLLIN);
+            }
+
+            static int OpenReserve() {
+                return open("/dev/null", O_RDONLY | O_CLOEXEC);
+            }
+
+            void Accept(int listener) {
+                for (;;) {
+                    const int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED) {
+                            continue;
+                        }
+                        if (errno == EMFILE || errno == ENFILE) {
+                            // the listener stays readable, the connection is
+                            // dropped instead of waking the loop over and over
+                            if (DropConnection(listener)) {
+                                continue;
+                            }
+                            PauseListener(listener);
+                        }
+                        // EAGAIN once the backlog is empty, or a shared socket emptied by another loop
+                        return;
+                    }
+                    const int enable = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+                    myConnections[fd].reset(new Connection(fd, myOwner.myFraming, myOwner.myMaxMessageSize));
+                    // both directions stay watched, edges are only reported on changes
+                    Watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+                }
+            }
+
+            // Out of descriptors, accepts the next connection with the
+            // reserved one and closes it
+            bool DropConnection(int listener) {
+                if (myReserveFd < 0) {
+                    return false;
+                }
+                close(myReserveFd);
+                const int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd >= 0) {
+                    close(fd);
+                }
+                myReserveFd = OpenReserve();
+                return fd >= 0;
+            }
+
+            // Without a reserved descriptor, stops watching the listener
+            // until one of the connections is closed
+            void PauseListener(int listener) {
+                epoll_ctl(myEpoll, EPOLL_CTL_DEL, listener, nullptr);
+                myPausedListeners.push_back(listener);
+            }
+
+            void OnEvent(Connection& connection, uint32_t events) {
+                if (events & EPOLLERR) {
+                    Close(connection);
+                    return;
+                }
+                if ((events & EPOLLOUT) && !Flush(connection)) {
+                    Close(connection);
+                    return;
+                }
+                if (connection.paused && connection.writer.GetPendingSize() <= myOwner.myMaxPendingOutput / 2) {
+                    // the data left unread raises no new edge
+                    connection.paused = false;
+                    events |= EPOLLIN;
+                }
+                if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) && !connection.paused && !Read(connection)) {
+                    Close(connection);
+                    return;
+                }
+                if (connection.closing && connection.writer.IsEmpty()) {
+                    Close(connection);
+                }
+            }
+
+            // Reads until the socket is drained or the connection paused,
+            // returns false on errors
+            bool Read(Connection& connection) {
+                Server& server = myOwner.myServer;
+                FrameWriter& writer = connection.writer;
+                while (!connection.paused && !connection.closing) {
+                    const ssize_t size = read(connection.fd, myBuffer, sizeof(myBuffer));
+                    if (size < 0) {
+                        if (errno == EINTR) {
+                            continue;
+                        }
+                        return errno == EAGAIN || errno == EWOULDBLOCK;
+                    }
+                    if (size == 0) {
+                        // answer what was read before closing
+                        connection.closing = true;
+                        break;
+                    }
+
+                    const bool framed = connection.reader.Feed(myBuffer, static_cast<size_t>(size), [&](StringRef message) {
+                        std::string response;
+                        server.HandleRequest(message, response);
+                        writer.Add(std::move(response));
+                    });
+                    if (!framed) {
+                        connection.closing = true;
+                    }
+                    if (!Flush(connection)) {
+                        return false;
+                    }
+                    if (writer.GetPendingSize() > myOwner.myMaxPendingOutput) {
+                        connection.paused = true;
+                    }
+                }
+                return true;
+            }
+
+            bool Flush(Connection& connection) {
+                return connection.writer.IsEmpty() || connection.writer.WriteTo(connection.fd);
+            }
+
+            void Close(Connection& connection) {
+                const int fd = connection.fd;
+                epoll_ctl(myEpoll, EPOLL_CTL_DEL, fd, nullptr);
+                close(fd);
+                myConnections.erase(fd);
+
+                if (myReserveFd < 0) {
+                    myReserveFd = OpenReserve();
+                }
+                for (auto& listener : myOwner.myListeners) {
+                    if (std::find(myPausedListeners.begin(), myPausedListeners.end(), listener.fd) != myPausedListeners.end()) {
+                        WatchListener(listener);
+                    }
+                }
+                myPausedListeners.clear();
+            }
+
+            SocketServer& myOwner;
+            size_t myIndex;
+            int myEpoll;
+            // closed to accept and drop connections when out of descriptors
+            int myReserveFd;
+            std::vector<int> myPausedListeners;
+            std::unordered_map<int, std::unique_ptr<Connection>> myConnections;
+            char myBuffer[65536];
+        };
+
+        int CreateSocket(int domain) {
+            const int fd = socket(domain, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (fd < 0) {
+                throw std::system_error(errno, std::system_category(), "socket");
+            }
+            return fd;
+        }
+
+        void Listen(int fd, size_t loop, bool shared) {
+            if (listen(fd, SOMAXCONN) != 0) {
+                CloseAndThrow(fd, "listen");
+            }
+            myListeners.push_back(Listener{ fd, loop, shared });
+        }
+
+        static void CloseAndThrow(int fd, const char* what) {
+            const int error = errno;
+            close(fd);
+            throw std::system_error(error, std::system_category(), what);
+        }
+
+        Server& myServer;
+        Framing myFraming;
+        size_t myLoopCount;
+        bool myReusePort;
+        size_t myMaxPendingOutput;
+        size_t myMaxMessageSize;
+        uint16_t myTcpPort;
+        int myStopFd;
+        std::vector<Listener> myListeners;
+        std::vector<std::string> myUnixPaths;
+        std::vector<std::thread> myThreads;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_SOCKETSERVER_H
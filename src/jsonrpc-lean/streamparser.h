@@ -0,0 +1,153 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_STREAMPARSER_H
+#define JSONRPC_LEAN_STREAMPARSER_H
+
+#include "jsonscanner.h"
+
+#include <cstddef>
+#include <string>
+
+namespace jsonrpc {
+
+    // Splits a stream of concatenated JSON-RPC messages, as read from a
+    // socket, into the top-level objects and arrays it is made of. Data is
+    // pushed in chunks of any size: the framing state is kept between them,
+    // so every byte is looked at once. Messages within a chunk are handed
+    // over straight from it, only one cut by the end of a chunk is copied
+    // until the rest of it arrives.
+    //
+    // Only the nesting and the strings are followed here, the messages are
+    // validated when they are read, e.g. by Server::HandleRequest.
+    class StreamParser {
+    public:
+        // 0 for no limit on the size of a message
+        explicit StreamParser(size_t maxMessageSize = 0) : myMaxMessageSize(maxMessageSize) {
+            Reset();
+        }
+
+        // Calls onMessage(StringRef message) for each message completed by
+        // data, which is only valid during the call. Returns false when the
+        // stream cannot be split anymore: something else than an object or
+        // an array at the top level, or a message over the size limit. The
+        // parser must then be Reset(), usually along with the connection.
+        template<typename Callback>
+        bool Feed(const char* data, size_t size, Callback&& onMessage) {
+            if (myFailed) {
+                return false;
+            }
+
+            const char* end = data + size;
+            const char* start = data;
+            for (const char* p = data; p != end; ++p) {
+                const char ch = *p;
+                if (myInString) {
+                    if (myEscaped) {
+                        myEscaped = false;
+                    } else if (ch == '\\') {
+                        myEscaped = true;
+                    } else if (ch == '"') {
+                        myInString = false;
+                    }
+                    continue;
+                }
+
+                if (myDepth == 0) {
+                    if (ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r') {
+                        continue;
+                    }
+                    if (ch != '{' && ch != '[') {
+                        return Fail();
+                    }
+                    start = p;
+                    myDepth = 1;
+                    continue;
+                }
+
+                switch (ch) {
+                case '"':
+                    myInString = true;
+                    break;
+                case '{':
+                case '[':
+                    ++myDepth;
+                    break;
+                case '}':
+                case ']':
+                    if (--myDepth == 0) {
+                        if (myBuffer.empty()) {
+                            if (!CheckSize(p + 1 - start)) {
+                                return false;
+                            }
+                            onMessage(StringRef(start, p + 1));
+                        } else {
+                            // the rest of the message cut by the previous chunk
+                            if (!CheckSize(myBuffer.size() + (p + 1 - data))) {
+                                return false;
+                            }
+                            myBuffer.append(data, p + 1 - data);
+                            onMessage(StringRef(myBuffer));
+                            myBuffer.clear();
+                        }
+                    }
+                    break;
+                default:
+                    break;
+                }
+            }
+
+            if (myDepth > 0) {
+                // keep the unfinished message for the next chunk
+                const char* from = myBuffer.empty() ? start : data;
+                if (!CheckSize(myBuffer.size() + (end - from))) {
+                    return false;
+                }
+                myBuffer.append(from, end - from);
+            }
+            return true;
+        }
+
+        template<typename Callback>
+        bool Feed(const std::string& data, Callback&& onMessage) {
+            return Feed(data.data(), data.size(), onMessage);
+        }
+
+        void Reset() {
+            myBuffer.clear();
+            myDepth = 0;
+            myInString = false;
+            myEscaped = false;
+            myFailed = false;
+        }
+
+        // False while a message is only partly received
+        bool IsIdle() const { return myDepth == 0 && !myFailed; }
+
+        size_t GetBufferedSize() const { return myBuffer.size(); }
+
+    private:
+        bool CheckSize(size_t size) {
+            if (myMaxMessageSize != 0 && size > myMaxMessageSize) {
+                return Fail();
+            }
+            return true;
+        }
+
+        bool Fail() {
+            myFailed = true;
+            myBuffer.clear();
+            return false;
+        }
+
+        size_t myMaxMessageSize;
+        std::string myBuffer;
+        size_t myDepth;
+        bool myInString;
+        bool myEscaped;
+        bool myFailed;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_STREAMPARSER_H
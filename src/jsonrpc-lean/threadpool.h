@@ -0,0 +1,216 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_THREADPOOL_H
+#define JSONRPC_LEAN_THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace jsonrpc {
+
+    // Work stealing pool: every worker has its own queue, tasks posted from
+    // a worker go to the back of its queue and it takes them back from there,
+    // while idle workers steal from the front of the others. Tasks posted
+    // from other threads are spread over the queues in turn. Workers out of
+    // tasks sleep on their own queue, posting only locks one to wake it when
+    // some are asleep.
+    class ThreadPool {
+    public:
+        explicit ThreadPool(size_t threads) : myPending(0), mySleeping(0), myNext(0), myStop(false) {
+            for (size_t i = 0; i < threads; ++i) {
+                myQueues.emplace_back(new Queue());
+            }
+            myThreads.reserve(threads);
+            for (size_t i = 0; i < threads; ++i) {
+                myThreads.emplace_back([this, i] { Run(i); });
+            }
+        }
+
+        // Runs the tasks still queued before returning
+        ~ThreadPool() {
+            myStop = true;
+            for (auto& queue : myQueues) {
+                // a worker checks myStop under its lock before sleeping
+                std::lock_guard<std::mutex> lock(queue->mutex);
+                queue->wake.notify_all();
+            }
+            for (auto& thread : myThreads) {
+                thread.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        size_t GetSize() const { return myThreads.size(); }
+
+        // Without workers the task runs on the calling thread
+        void Post(std::function<void()> task) {
+            if (myQueues.empty()) {
+                task();
+                return;
+            }
+            const size_t index = GetCurrent().pool == this ? GetCurrent().index : myNext++ % myQueues.size();
+            // counted first, so that it is never taken before. Then a worker
+            // going to sleep either sees it, or is counted in mySleeping.
+            ++myPending;
+            {
+                std::lock_guard<std::mutex> lock(myQueues[index]->mutex);
+                myQueues[index]->tasks.push_back(std::move(task));
+            }
+            if (mySleeping > 0) {
+                Wake(index);
+            }
+        }
+
+        // Runs task(0) .. task(count - 1) on the pool workers and the calling
+        // thread, and returns once every index is done. task must not throw.
+        // Called from a worker of the pool, the worker runs them all itself:
+        // the others may all be waiting the same way.
+        void ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+            if (GetCurrent().pool == this) {
+                for (size_t i = 0; i < count; ++i) {
+                    task(i);
+                }
+                return;
+            }
+            if (count == 0) {
+                return;
+            }
+
+            std::atomic<size_t> next(0);
+            auto work = [&]() {
+                for (size_t i = next++; i < count; i = next++) {
+                    task(i);
+                }
+            };
+
+            std::mutex mutex;
+            std::condition_variable finished;
+            size_t running = std::min(count - 1, myThreads.size());
+            for (size_t i = running; i > 0; --i) {
+                Post([&]() {
+                    work();
+                    // notify under the lock, the waiter owns mutex and condition
+                    std::lock_guard<std::mutex> lock(mutex);
+                    --running;
+                    finished.notify_one();
+                });
+            }
+
+            work();
+
+            std::unique_lock<std::mutex> lock(mutex);
+            finished.wait(lock, [&] { return running == 0; });
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+            // its worker waits there, until a Wake() clears sleeping
+            std::condition_variable wake;
+            bool sleeping = false;
+        };
+
+        struct Current {
+            ThreadPool* pool;
+            size_t index;
+        };
+
+        static Current& GetCurrent() {
+            static thread_local Current current = { nullptr, 0 };
+            return current;
+        }
+
+        // The newest task of the own queue, or the oldest of another one
+        bool Take(size_t index, std::function<void()>& task) {
+            {
+                Queue& own = *myQueues[index];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    task = std::move(own.tasks.back());
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < myQueues.size(); ++i) {
+                Queue& other = *myQueues[(index + i) % myQueues.size()];
+                std::lock_guard<std::mutex> lock(other.mutex);
+                if (!other.tasks.empty()) {
+                    task = std::move(other.tasks.front());
+                    other.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Wakes a sleeping worker, that of the queue posted to first
+        void Wake(size_t index) {
+            for (size_t i = 0; i < myQueues.size(); ++i) {
+                Queue& queue = *myQueues[(index + i) % myQueues.size()];
+                std::lock_guard<std::mutex> lock(queue.mutex);
+                if (queue.sleeping) {
+                    // the next Wake() picks another one
+                    queue.sleeping = false;
+                    --mySleeping;
+                    queue.wake.notify_one();
+                    return;
+                }
+            }
+        }
+
+        void Run(size_t index) {
+            GetCurrent() = Current{ this, index };
+            Queue& own = *myQueues[index];
+            for (;;) {
+                std::function<void()> task;
+                if (Take(index, task)) {
+                    --myPending;
+                    task();
+                    continue;
+                }
+
+                // myPending counts the queued tasks nobody took yet
+                std::unique_lock<std::mutex> lock(own.mutex);
+                for (;;) {
+                    if (!own.sleeping) {
+                        own.sleeping = true;
+                        ++mySleeping;
+                    }
+                    if (myStop || myPending > 0) {
+                        break;
+                    }
+                    own.wake.wait(lock);
+                }
+                if (own.sleeping) {
+                    own.sleeping = false;
+                    --mySleeping;
+                }
+                // another worker may have taken the task it woke up for
+                if (myStop && myPending == 0) {
+                    return;
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<Queue>> myQueues;
+        std::vector<std::thread> myThreads;
+        std::atomic<size_t> myPending;
+        std::atomic<size_t> mySleeping;
+        std::atomic<size_t> myNext;
+        std::atomic<bool> myStop;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_THREADPOOL_H
@@ -0,0 +1,207 @@
+// This file is part of jsonrpc-lean, a c++11 JSON-RPC client/server library.
+//
+
+#ifndef JSONRPC_LEAN_TRACER_H
+#define JSONRPC_LEAN_TRACER_H
+
+#include "json.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <system_error>
+
+#include <cerrno>
+#include <unistd.h>
+
+namespace jsonrpc {
+
+    // Hooks called by the Server around the stages of each request, see
+    // Server::SetTracer(). They are called from the threads handling the
+    // requests, concurrently when there are several, and an asynchronous
+    // method ends its dispatch stage on the thread completing it.
+    class Tracer {
+    public:
+        enum Stage {
+            // reading the request text, id and method are only known at the end
+            PARSE,
+            // from the Dispatcher being called to the response it returns
+            DISPATCH,
+            // writing the response text
+            SERIALIZE
+        };
+
+        typedef std::chrono::steady_clock Clock;
+
+        virtual ~Tracer() {}
+
+        // id is null and method empty when not known yet
+        virtual void Begin(Stage stage, const Json& id, const std::string& method) {
+            (void)stage;
+            (void)id;
+            (void)method;
+        }
+
+        // start is the time the stage began at
+        virtual void End(Stage stage, const Json& id, const std::string& method, Clock::time_point start) = 0;
+
+        static const char* GetStageName(Stage stage) {
+            switch (stage) {
+            case PARSE:
+                return "parse";
+            case DISPATCH:
+                return "dispatch";
+            default:
+                return "serialize";
+            }
+        }
+
+        static const Json& GetNoId() {
+            static const Json id;
+            return id;
+        }
+
+        static const std::string& GetNoMethod() {
+            static const std::string method;
+            return method;
+        }
+    };
+
+    // One stage of a request, ended by End() or at the end of the scope.
+    // Nothing is done without a tracer.
+    class TraceScope {
+    public:
+        TraceScope(Tracer* tracer, Tracer::Stage stage)
+            : TraceScope(tracer, stage, Tracer::GetNoId(), Tracer::GetNoMethod()) {}
+
+        // id and method must outlive the scope
+        TraceScope(Tracer* tracer, Tracer::Stage stage, const Json& id, const std::string& method)
+            : myTracer(tracer), myStage(stage), myId(&id), myMethod(&method) {
+            if (myTracer) {
+                myStart = Tracer::Clock::now();
+                myTracer->Begin(myStage, id, method);
+            }
+        }
+
+        TraceScope(TraceScope&& other)
+            : myTracer(other.myTracer), myStage(other.myStage), myId(other.myId), myMethod(other.myMethod), myStart(other.myStart) {
+            other.myTracer = nullptr;
+        }
+
+        TraceScope(const TraceScope&) = delete;
+        TraceScope& operator=(const TraceScope&) = delete;
+
+        ~TraceScope() {
+            End();
+        }
+
+        // The request read by the parse stage
+        void SetRequest(const Json& id, const std::string& method) {
+            myId = &id;
+            myMethod = &method;
+        }
+
+        void End() {
+            if (myTracer) {
+                myTracer->End(myStage, *myId, *myMethod, myStart);
+                myTracer = nullptr;
+            }
+        }
+
+    private:
+        Tracer* myTracer;
+        Tracer::Stage myStage;
+        const Json* myId;
+        const std::string* myMethod;
+        Tracer::Clock::time_point myStart;
+    };
+
+    // Writes the stages as complete events of the Chrome trace event format,
+    // which chrome://tracing and ui.perfetto.dev open. Events are buffered
+    // and written out every bufferSize bytes, and the file is only valid
+    // JSON once the writer is destroyed.
+    class ChromeTraceWriter : public Tracer {
+    public:
+        explicit ChromeTraceWriter(const std::string& path, size_t bufferSize = 64 << 10)
+            : myFile(fopen(path.c_str(), "w")), myBufferSize(bufferSize), myEmpty(true), myOrigin(Clock::now()) {
+            if (!myFile) {
+                throw std::system_error(errno, std::system_category(), path);
+            }
+            myBuffer.reserve(myBufferSize + 256);
+            myBuffer = "{\"traceEvents\":[\n";
+        }
+
+        ~ChromeTraceWriter() {
+            std::lock_guard<std::mutex> lock(myMutex);
+            myBuffer += "\n],\"displayTimeUnit\":\"ns\"}\n";
+            WriteBuffer();
+            fclose(myFile);
+        }
+
+        ChromeTraceWriter(const ChromeTraceWriter&) = delete;
+        ChromeTraceWriter& operator=(const ChromeTraceWriter&) = delete;
+
+        void End(Stage stage, const Json& id, const std::string& method, Clock::time_point start) override {
+            const Clock::time_point end = Clock::now();
+            char times[128];
+            snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u",
+                GetMicroseconds(start - myOrigin), GetMicroseconds(end - start), static_cast<int>(getpid()), GetThreadId());
+            // built outside of the lock
+            std::string event = "{\"name\":\"";
+            event += GetStageName(stage);
+            event += "\",\"cat\":\"jsonrpc\",\"ph\":\"X\",";
+            event += times;
+            event += ",\"args\":{\"id\":";
+            event += id.dump();
+            event += ",\"method\":";
+            event += Json(method).dump();
+            event += "}}";
+
+            std::lock_guard<std::mutex> lock(myMutex);
+            if (!myEmpty) {
+                myBuffer += ",\n";
+            }
+            myBuffer += event;
+            myEmpty = false;
+            if (myBuffer.size() >= myBufferSize) {
+                WriteBuffer();
+            }
+        }
+
+        // Writes out the buffered events
+        void Flush() {
+            std::lock_guard<std::mutex> lock(myMutex);
+            WriteBuffer();
+            fflush(myFile);
+        }
+
+    private:
+        static double GetMicroseconds(Clock::duration duration) {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count() / 1000.0;
+        }
+
+        // Small numbers, the viewers show them as names
+        static unsigned GetThreadId() {
+            static std::atomic<unsigned> nextId(1);
+            static thread_local unsigned id = nextId++;
+            return id;
+        }
+
+        void WriteBuffer() {
+            fwrite(myBuffer.data(), 1, myBuffer.size(), myFile);
+            myBuffer.clear();
+        }
+
+        FILE* myFile;
+        const size_t myBufferSize;
+        std::mutex myMutex;
+        std::string myBuffer;
+        bool myEmpty;
+        const Clock::time_point myOrigin;
+    };
+
+} // namespace jsonrpc
+
+#endif // JSONRPC_LEAN_TRACER_H
@@ -10,7 +10,12 @@
 #include <stdint.h>
 #include <string.h>
 #include <cassert>
+#include <string>
 
+#if !defined(JSONRPC_LEAN_DISABLE_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define JSONRPC_LEAN_BASE64_SIMD
+#include <immintrin.h>
+#endif
 
 namespace {
 
@@ -58,88 +63,455 @@ namespace {
 
 namespace jsonrpc {
     namespace util {
-        inline std::string Base64Encode(const std::string& data); // forward declaration
-
-        inline std::string Base64Encode(const char* data, size_t size) {
-            const size_t lineLength = 76;
-            static_assert(lineLength % 4 == 0, "invalid line length");
+        // Line length of the text Base64Encode() wraps with CRLF
+        const size_t BASE_64_LINE_LENGTH = 76;
 
+        inline size_t Base64EncodedSize(size_t size, size_t lineLength = BASE_64_LINE_LENGTH) {
             if (size == 0) {
-                return{};
+                return 0;
             }
-
             const size_t encodedSize = 4 * ((size + 2) / 3);
-            std::string str(encodedSize + 2 * ((encodedSize - 1) / lineLength), '\0');
+            return lineLength == 0 ? encodedSize : encodedSize + 2 * ((encodedSize - 1) / lineLength);
+        }
 
-            size_t in = 0;
-            size_t out = 0;
-            for (size_t wrap = lineLength; in + 3 <= size; in += 3, wrap -= 4) {
-                if (wrap == 0) {
-                    str[out++] = '\r';
-                    str[out++] = '\n';
-                    wrap = lineLength;
+        // Upper bound, the text may hold padding and line breaks
+        inline size_t Base64DecodedMaxSize(size_t size) {
+            return 3 * ((size + 3) / 4);
+        }
+
+        namespace detail {
+
+            // Decoding state carried from one chunk to the next
+            struct Base64DecodeState {
+                uint32_t bits;
+                size_t bitCount;
+            };
+
+#ifdef JSONRPC_LEAN_BASE64_SIMD
+            // The SIMD kernels follow Muła and Lemire, "Faster Base64
+            // Encoding and Decoding using AVX2 Instructions". They only see
+            // whole blocks of the alphabet, everything else (line breaks,
+            // padding, characters to skip) is left to the scalar code.
+            enum Base64Simd {
+                BASE_64_SCALAR,
+                BASE_64_SSE41,
+                BASE_64_AVX2
+            };
+
+            inline Base64Simd DetectBase64Simd() {
+                __builtin_cpu_init();
+                if (__builtin_cpu_supports("avx2")) {
+                    return BASE_64_AVX2;
+                }
+                if (__builtin_cpu_supports("sse4.1")) {
+                    return BASE_64_SSE41;
+                }
+                return BASE_64_SCALAR;
+            }
+
+            inline Base64Simd GetBase64Simd() {
+                static const Base64Simd simd = DetectBase64Simd();
+                return simd;
+            }
+
+            // 12 bytes to 16 characters
+            __attribute__((target("sse4.1")))
+            inline void Base64EncodeBlock(const char* data, char* str) {
+                __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+                in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+                const __m128i high = _mm_mulhi_epu16(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)), _mm_set1_epi32(0x04000040));
+                const __m128i low = _mm_mullo_epi16(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)), _mm_set1_epi32(0x01000010));
+                const __m128i indices = _mm_or_si128(high, low);
+
+                // offset to add to each index, picked by its range
+                __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+                const __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+                range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+                const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+                const __m128i out = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(str), out);
+            }
+
+            // 16 characters to 12 bytes, false when one is not in the alphabet.
+            // Writes 16 bytes.
+            __attribute__((target("sse4.1")))
+            inline bool Base64DecodeBlock(const char* str, char* data) {
+                const __m128i in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str));
+                const __m128i mask = _mm_set1_epi8(0x2f);
+                const __m128i highNibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask);
+                const __m128i lowNibbles = _mm_and_si128(in, mask);
+                const __m128i lowLut = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+                const __m128i highLut = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+                if (!_mm_testz_si128(_mm_shuffle_epi8(lowLut, lowNibbles), _mm_shuffle_epi8(highLut, highNibbles))) {
+                    return false;
+                }
+
+                const __m128i rollLut = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+                const __m128i roll = _mm_shuffle_epi8(rollLut, _mm_add_epi8(_mm_cmpeq_epi8(in, mask), highNibbles));
+                const __m128i values = _mm_add_epi8(in, roll);
+                const __m128i pairs = _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140));
+                __m128i out = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+                out = _mm_shuffle_epi8(out, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(data), out);
+                return true;
+            }
+
+            // Encodes whole groups while the 16 bytes loaded stay within
+            // available, returns how many
+            __attribute__((target("sse4.1")))
+            inline size_t Base64EncodeSse41(const char* data, size_t groups, size_t available, char* str) {
+                size_t done = 0;
+                for (; done + 4 <= groups && 3 * done + 16 <= available; done += 4) {
+                    Base64EncodeBlock(data + 3 * done, str + 4 * done);
+                }
+                return done;
+            }
+
+            // 24 bytes to 32 characters at a time, one half per 128-bit lane
+            __attribute__((target("avx2")))
+            inline size_t Base64EncodeAvx2(const char* data, size_t groups, size_t available, char* str) {
+                const __m256i shuffle = _mm256_broadcastsi128_si256(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+                const __m256i offsets = _mm256_broadcastsi128_si256(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0));
+                size_t done = 0;
+                for (; done + 8 <= groups && 3 * done + 28 <= available; done += 8) {
+                    const char* p = data + 3 * done;
+                    __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+                        _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), 1);
+                    in = _mm256_shuffle_epi8(in, shuffle);
+                    const __m256i high = _mm256_mulhi_epu16(_mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00)), _mm256_set1_epi32(0x04000040));
+                    const __m256i low = _mm256_mullo_epi16(_mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0)), _mm256_set1_epi32(0x01000010));
+                    const __m256i indices = _mm256_or_si256(high, low);
+
+                    __m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+                    const __m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+                    range = _mm256_or_si256(range, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+                    const __m256i out = _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(str + 4 * done), out);
+                }
+                return done + Base64EncodeSse41(data + 3 * done, groups - done, available - 3 * done, str + 4 * done);
+            }
+
+            // Decodes blocks of the alphabet from the start of str, returns
+            // how many characters were consumed. Writes past the decoded
+            // bytes, so that is only done while size leaves room for it.
+            __attribute__((target("sse4.1")))
+            inline size_t Base64DecodeSse41(const char* str, size_t size, char* data) {
+                size_t in = 0;
+                for (; in + 32 <= size && Base64DecodeBlock(str + in, data); in += 16) {
+                    data += 12;
+                }
+                return in;
+            }
+
+            __attribute__((target("avx2")))
+            inline size_t Base64DecodeAvx2(const char* str, size_t size, char* data) {
+                const __m256i mask = _mm256_set1_epi8(0x2f);
+                const __m256i lowLut = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+                const __m256i highLut = _mm256_broadcastsi128_si256(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+                const __m256i rollLut = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0));
+                const __m256i pack = _mm256_broadcastsi128_si256(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+
+                size_t in = 0;
+                while (in + 48 <= size) {
+                    const __m256i chars = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(str + in));
+                    const __m256i highNibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), mask);
+                    const __m256i lowNibbles = _mm256_and_si256(chars, mask);
+                    if (!_mm256_testz_si256(_mm256_shuffle_epi8(lowLut, lowNibbles), _mm256_shuffle_epi8(highLut, highNibbles))) {
+                        break;
+                    }
+                    const __m256i roll = _mm256_shuffle_epi8(rollLut, _mm256_add_epi8(_mm256_cmpeq_epi8(chars, mask), highNibbles));
+                    const __m256i values = _mm256_add_epi8(chars, roll);
+                    const __m256i pairs = _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+                    __m256i out = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+                    out = _mm256_shuffle_epi8(out, pack);
+                    out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(data), out);
+                    data += 24;
+                    in += 32;
+                }
+                // a line break may still leave a block of 16 before it
+                return in + Base64DecodeSse41(str + in, size - in, data);
+            }
+#endif // JSONRPC_LEAN_BASE64_SIMD
+
+            // Encodes groups of 3 bytes without line breaks, available bytes
+            // can be read from data
+            inline void Base64EncodeRun(const char* data, size_t groups, size_t available, char* str) {
+                size_t done = 0;
+#ifdef JSONRPC_LEAN_BASE64_SIMD
+                const Base64Simd simd = GetBase64Simd();
+                if (simd == BASE_64_AVX2) {
+                    done = Base64EncodeAvx2(data, groups, available, str);
+                } else if (simd == BASE_64_SSE41) {
+                    done = Base64EncodeSse41(data, groups, available, str);
+                }
+#else
+                (void)available;
+#endif
+                for (; done < groups; ++done) {
+                    const char* in = data + 3 * done;
+                    char* out = str + 4 * done;
+                    out[0] = Base64Char0(in[0]);
+                    out[1] = Base64Char1(in[0], in[1]);
+                    out[2] = Base64Char2(in[1], in[2]);
+                    out[3] = Base64Char3(in[2]);
+                }
+            }
+
+            // Encodes groups of 3 bytes, with a CRLF before a group that would
+            // start past lineLength characters, column is the length of the
+            // current line. Returns how many characters were written.
+            inline size_t Base64EncodeGroups(const char* data, size_t groups, size_t available, char* str,
+                size_t lineLength, size_t& column) {
+                size_t out = 0;
+                size_t done = 0;
+                while (done < groups) {
+                    if (lineLength != 0 && column == lineLength) {
+                        str[out++] = '\r';
+                        str[out++] = '\n';
+                        column = 0;
+                    }
+                    size_t count = groups - done;
+                    if (lineLength != 0 && count > (lineLength - column) / 4) {
+                        count = (lineLength - column) / 4;
+                    }
+                    Base64EncodeRun(data + 3 * done, count, available - 3 * done, str + out);
+                    out += 4 * count;
+                    column += 4 * count;
+                    done += count;
                 }
-                str[out++] = Base64Char0(data[in]);
-                str[out++] = Base64Char1(data[in], data[in + 1]);
-                str[out++] = Base64Char2(data[in + 1], data[in + 2]);
-                str[out++] = Base64Char3(data[in + 2]);
+                return out;
             }
 
-            if (in < size) {
-                str[out++] = Base64Char0(data[in]);
-                if (in + 1 < size) {
-                    str[out++] = Base64Char1(data[in], data[in + 1]);
-                    str[out++] = Base64Char2(data[in + 1], 0);
+            // The last 1 or 2 bytes, padded
+            inline size_t Base64EncodeTail(const char* data, size_t size, char* str, size_t lineLength, size_t& column) {
+                size_t out = 0;
+                if (lineLength != 0 && column == lineLength) {
+                    str[out++] = '\r';
+                    str[out++] = '\n';
+                    column = 0;
+                }
+                str[out++] = Base64Char0(data[0]);
+                if (size > 1) {
+                    str[out++] = Base64Char1(data[0], data[1]);
+                    str[out++] = Base64Char2(data[1], 0);
                 } else {
-                    str[out++] = Base64Char1(data[in], 0);
+                    str[out++] = Base64Char1(data[0], 0);
                     str[out++] = '=';
                 }
                 str[out++] = '=';
+                column += 4;
+                return out;
+            }
+
+            // Decodes a chunk of text, the bits of an unfinished group are
+            // kept in state. Writes at most Base64DecodedMaxSize(size + 3).
+            inline size_t Base64DecodeChunk(const char* str, size_t size, char* data, Base64DecodeState& state) {
+                size_t out = 0;
+                uint32_t bits = state.bits;
+                size_t bitCount = state.bitCount;
+
+                // the vector code stopped at a block with a character to skip
+                size_t scalarUntil = 0;
+                for (size_t in = 0; in < size; ++in) {
+#ifdef JSONRPC_LEAN_BASE64_SIMD
+                    if (bitCount == 0 && in >= scalarUntil && size - in >= 32) {
+                        const Base64Simd simd = GetBase64Simd();
+                        size_t consumed = 0;
+                        if (simd == BASE_64_AVX2) {
+                            consumed = Base64DecodeAvx2(str + in, size - in, data + out);
+                        } else if (simd == BASE_64_SSE41) {
+                            consumed = Base64DecodeSse41(str + in, size - in, data + out);
+                        }
+                        out += consumed / 4 * 3;
+                        in += consumed;
+                        scalarUntil = in + 16;
+                        if (in == size) {
+                            break;
+                        }
+                    }
+#endif
+                    const int value = BASE_64_LUT[static_cast<uint8_t>(str[in])];
+                    if (value != -1) {
+                        bits = (bits << 6) | value;
+                        bitCount += 6;
+                        if (bitCount == 24) {
+                            data[out++] = bits >> 16;
+                            data[out++] = bits >> 8;
+                            data[out++] = bits;
+
+                            bits = 0;
+                            bitCount = 0;
+                        }
+                    }
+                }
+
+                (void)scalarUntil;
+                state.bits = bits;
+                state.bitCount = bitCount;
+                return out;
+            }
+
+            // What is left of an unfinished group
+            inline size_t Base64DecodeFinish(char* data, Base64DecodeState& state) {
+                size_t out = 0;
+                if (state.bitCount >= 12) {
+                    const uint32_t bits = state.bits >> (state.bitCount % 8);
+                    if (state.bitCount == 18) {
+                        data[out++] = bits >> 8;
+                    }
+                    data[out++] = bits;
+                }
+                state.bits = 0;
+                state.bitCount = 0;
+                return out;
+            }
+
+        } // namespace detail
+
+        // Writes exactly Base64EncodedSize(size, lineLength) characters to
+        // out, with a CRLF every lineLength characters, or none for 0
+        inline size_t Base64EncodeInto(const char* data, size_t size, char* str, size_t lineLength = BASE_64_LINE_LENGTH) {
+            assert(lineLength % 4 == 0);
+
+            size_t column = 0;
+            const size_t groups = size / 3;
+            size_t out = detail::Base64EncodeGroups(data, groups, size, str, lineLength, column);
+            if (size % 3 != 0) {
+                out += detail::Base64EncodeTail(data + 3 * groups, size % 3, str + out, lineLength, column);
             }
 
-            assert(str.size() == out);
+            assert(Base64EncodedSize(size, lineLength) == out);
+            return out;
+        }
+
+        // Appends the encoded data to str, without going through a temporary
+        inline void Base64EncodeAppend(const char* data, size_t size, std::string& str, size_t lineLength = BASE_64_LINE_LENGTH) {
+            const size_t offset = str.size();
+            str.resize(offset + Base64EncodedSize(size, lineLength));
+            if (size != 0) {
+                Base64EncodeInto(data, size, &str[offset], lineLength);
+            }
+        }
+
+        inline std::string Base64Encode(const std::string& data); // forward declaration
+
+        inline std::string Base64Encode(const char* data, size_t size) {
+            std::string str;
+            Base64EncodeAppend(data, size, str);
             return str;
         }
 
+        // Writes at most Base64DecodedMaxSize(size) bytes to data and returns
+        // how many. Characters outside of the alphabet, like line breaks,
+        // are skipped.
+        inline size_t Base64DecodeInto(const char* str, size_t size, char* data) {
+            detail::Base64DecodeState state = { 0, 0 };
+            size_t out = detail::Base64DecodeChunk(str, size, data, state);
+            out += detail::Base64DecodeFinish(data + out, state);
+
+            assert(Base64DecodedMaxSize(size) >= out);
+            return out;
+        }
+
+        // Appends the decoded data to data
+        inline void Base64DecodeAppend(const char* str, size_t size, std::string& data) {
+            const size_t offset = data.size();
+            data.resize(offset + Base64DecodedMaxSize(size));
+            const size_t decoded = size == 0 ? 0 : Base64DecodeInto(str, size, &data[offset]);
+            data.resize(offset + decoded);
+        }
+
         inline std::string Base64Decode(const std::string& str); // forward declaration
 
         inline std::string Base64Decode(const char* str, size_t size) {
-            const size_t maxDecodedSize = 3 * ((size + 3) / 4);
-
-            std::string data(maxDecodedSize, '\0');
+            std::string data;
+            Base64DecodeAppend(str, size, data);
+            return data;
+        }
 
-            size_t out = 0;
-            uint32_t bits = 0;
-            size_t bitCount = 0;
+        // Encodes data pushed in chunks of any size to the same text
+        // Base64Encode() gives for all of it
+        class Base64Encoder {
+        public:
+            explicit Base64Encoder(size_t lineLength = BASE_64_LINE_LENGTH)
+                : myLineLength(lineLength), myColumn(0), myPendingSize(0) {
+                assert(lineLength % 4 == 0);
+            }
 
-            for (size_t in = 0; in < size; ++in) {
-                const int value = BASE_64_LUT[static_cast<uint8_t>(str[in])];
-                if (value != -1) {
-                    bits = (bits << 6) | value;
-                    bitCount += 6;
-                    if (bitCount == 24) {
-                        data[out++] = bits >> 16;
-                        data[out++] = bits >> 8;
-                        data[out++] = bits;
+            // Appends what can be encoded so far to str
+            void Update(const char* data, size_t size, std::string& str) {
+                while (myPendingSize != 0 && myPendingSize < 3 && size != 0) {
+                    myPending[myPendingSize++] = *data++;
+                    --size;
+                }
+                const size_t groups = size / 3;
+                const size_t offset = str.size();
+                // the pending group, and a line break for each line started
+                const size_t encoded = 4 * (groups + 1);
+                str.resize(offset + encoded + (myLineLength == 0 ? 0 : 2 * (encoded / myLineLength + 1)));
 
-                        bits = 0;
-                        bitCount = 0;
-                    }
+                size_t out = offset;
+                if (myPendingSize == 3) {
+                    out += detail::Base64EncodeGroups(myPending, 1, 3, &str[out], myLineLength, myColumn);
+                    myPendingSize = 0;
+                }
+                if (myPendingSize == 0) {
+                    out += detail::Base64EncodeGroups(data, groups, size, &str[out], myLineLength, myColumn);
+                    myPendingSize = size % 3;
+                    memcpy(myPending, data + 3 * groups, myPendingSize);
                 }
+                str.resize(out);
             }
 
-            if (bitCount >= 12) {
-                bits = bits >> (bitCount % 8);
-                if (bitCount == 18) {
-                    data[out++] = bits >> 8;
+            // Appends the padded end to str, the encoder can then be reused
+            void Finish(std::string& str) {
+                if (myPendingSize != 0) {
+                    char tail[6];
+                    str.append(tail, detail::Base64EncodeTail(myPending, myPendingSize, tail, myLineLength, myColumn));
                 }
-                data[out++] = bits;
+                myColumn = 0;
+                myPendingSize = 0;
             }
 
-            assert(data.size() >= out);
-            data.resize(out);
-            return data;
-        }
+        private:
+            size_t myLineLength;
+            size_t myColumn;
+            char myPending[3];
+            size_t myPendingSize;
+        };
+
+        // Decodes text pushed in chunks of any size, like Base64Decode()
+        class Base64Decoder {
+        public:
+            Base64Decoder() {
+                myState.bits = 0;
+                myState.bitCount = 0;
+            }
+
+            // Appends what can be decoded so far to data
+            void Update(const char* str, size_t size, std::string& data) {
+                const size_t offset = data.size();
+                data.resize(offset + Base64DecodedMaxSize(size + 3));
+                data.resize(offset + detail::Base64DecodeChunk(str, size, &data[offset], myState));
+            }
+
+            // Appends the end of an unpadded text to data, the decoder can
+            // then be reused
+            void Finish(std::string& data) {
+                char tail[2];
+                data.append(tail, detail::Base64DecodeFinish(tail, myState));
+            }
+
+        private:
+            detail::Base64DecodeState myState;
+        };
 
     } // namespace util
 } // namespace jsonrpc
@@ -7,12 +7,28 @@
 
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <fstream>
 #include <functional>
+#include <future>
+#include <mutex>
 #include <numeric>
+#include <thread>
 #include <tuple>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "jsonrpc-lean/server.h"
+#include "jsonrpc-lean/client.h"
+#include "jsonrpc-lean/executor.h"
+#include "jsonrpc-lean/framing.h"
+#include "jsonrpc-lean/socketserver.h"
+#include "jsonrpc-lean/streamparser.h"
 
 using testing::_;
 using testing::Args;
@@ -212,6 +228,1117 @@ TEST_F(JsonRpcTest, InvokeAlias) {
 }
 
 
+/// @test
+TEST_F(JsonRpcTest, InvokeManyMethods) {
+    jsonrpc::Dispatcher d;
+    for (int i = 0; i < 500; ++i) {
+        d.AddMethod("method" + std::to_string(i), [i]() { return i; });
+    }
+    d.AddAlias("method7", "seven");
+    d.AddAlias("gone", "dangling");
+
+    for (int i = 0; i < 500; i += 37) {
+        EXPECT_EQ(d.Invoke("method" + std::to_string(i), {}, Json(i)).GetResult(), Json(i));
+    }
+    EXPECT_EQ(d.Invoke("seven", {}, Json(1)).GetResult(), Json(7));
+
+    d.RemoveMethod("method7");
+    EXPECT_TRUE(d.Invoke("method7", {}, Json(1)).IsFault());
+    EXPECT_TRUE(d.Invoke("seven", {}, Json(1)).IsFault());
+    EXPECT_TRUE(d.Invoke("dangling", {}, Json(1)).IsFault());
+    EXPECT_EQ(d.Invoke("method8", {}, Json(1)).GetResult(), Json(8));
+}
+
+/// @test
+TEST_F(JsonRpcTest, InvokeHandle) {
+    auto concat = dispatcher.Resolve("concat_alias");
+    ASSERT_TRUE(static_cast<bool>(concat));
+    EXPECT_CALL(GlobalMock, Concat("Hello, ", "World!")).Times(2).WillRepeatedly(Return("Hello, World!"));
+    for (int i = 0; i < 2; ++i) {
+        auto result = dispatcher.Invoke(concat, {Json("World!")}, Json(i));
+        EXPECT_EQ(result.GetResult(), Json("Hello, World!"));
+        EXPECT_EQ(result.GetId(), Json(i));
+    }
+
+    // padded to four parameters
+    auto test = dispatcher.Resolve("test");
+    EXPECT_FALSE(dispatcher.Invoke(test, {Json(1)}, Json(1)).IsFault());
+
+    auto unknown = dispatcher.Resolve("unknown");
+    EXPECT_FALSE(static_cast<bool>(unknown));
+    EXPECT_TRUE(dispatcher.Invoke(unknown, {}, Json(1)).IsFault());
+}
+
+/// @test
+TEST_F(JsonRpcTest, WriteResponse) {
+    std::string tricky = "q\"b\\s/\b\f\n\r\t\x01\x1f \xe2\x80\xa8\xe2\x80\xa9\xe2\x82\xac end";
+    std::vector<jsonrpc::Response> responses = {
+        jsonrpc::Response(Json(Json::object{{"a", Json::array{1, 2.5, tricky}}, {"b", nullptr}}), Json("id")),
+        jsonrpc::Response(Json(1e300 * 1e300), Json(7)),
+        jsonrpc::Response(-32000, tricky, Json()),
+        jsonrpc::Response(3, "message", tricky, Json(2)),
+    };
+    for (auto& r : responses) {
+        std::string out = "prefix";
+        r.Write(out);
+        EXPECT_EQ(out, "prefix" + r.Write().dump());
+    }
+
+    // appends to the buffer, nothing for a notification
+    std::string out = "[";
+    EXPECT_CALL(GlobalMock, Add(3, 2)).WillOnce(Return(5));
+    server.HandleRequest(addRequest, out);
+    server.HandleRequest(printNotificationRequest, out);
+    EXPECT_EQ(out, "[{\"id\": 0, \"jsonrpc\": \"2.0\", \"result\": 5}");
+}
+
+/// @test
+TEST_F(JsonRpcTest, InvokeWithArena) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("sum", [](const Json::array& a, int b) {
+        return std::accumulate(a.begin(), a.end(), double(b), [](double s, const Json& v) { return s + v.number_value(); });
+    });
+    server2.GetDispatcher().AddAlias("sum", "sum_alias", Json::array{1, 2, 3});
+    server2.SetRequestArena();
+    server2.SetBatchConcurrency(2);
+
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"sum_alias\",\"id\":1,\"params\":[4]}"),
+            "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": 10}");
+        EXPECT_EQ(server2.HandleRequest("[{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"id\":1,\"params\":[[1,1],1]},"
+            "{\"jsonrpc\":\"2.0\",\"method\":\"sum\",\"id\":2,\"params\":[[],2]}]"),
+            "[{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": 3}, {\"id\": 2, \"jsonrpc\": \"2.0\", \"result\": 2}]");
+    }
+
+    jsonrpc::Arena arena(64);
+    jsonrpc::Request::Parameters copy;
+    {
+        jsonrpc::ArenaScope scope(&arena);
+        jsonrpc::Request::Parameters params(jsonrpc::Request::Parameters::allocator_type(jsonrpc::Arena::GetCurrent()));
+        for (int i = 0; i < 100; ++i) {
+            params.push_back(Json(i));
+        }
+        EXPECT_EQ(params.get_allocator().GetArena(), &arena);
+        copy = params;
+    }
+    EXPECT_EQ(copy.get_allocator().GetArena(), nullptr);
+    ASSERT_EQ(copy.size(), 100u);
+    EXPECT_EQ(copy[99], Json(99));
+
+    // swapped containers take their arena along
+    jsonrpc::Arena other(64);
+    std::vector<int, jsonrpc::ArenaAllocator<int>> first(100, 1, jsonrpc::ArenaAllocator<int>(&arena));
+    std::vector<int, jsonrpc::ArenaAllocator<int>> second{ jsonrpc::ArenaAllocator<int>(&other) };
+    second.push_back(2);
+    first.swap(second);
+    EXPECT_EQ(first.get_allocator().GetArena(), &other);
+    EXPECT_EQ(second.get_allocator().GetArena(), &arena);
+    EXPECT_EQ(first, (std::vector<int, jsonrpc::ArenaAllocator<int>>(1, 2)));
+
+    // parameters too, whether kept inline or not
+    const jsonrpc::Request::Parameters::allocator_type fromOther(&other);
+    jsonrpc::Request::Parameters many(10, Json(1), jsonrpc::Request::Parameters::allocator_type(&arena));
+    jsonrpc::Request::Parameters few(fromOther);
+    few.push_back(Json(2));
+    swap(many, few);
+    EXPECT_EQ(many.get_allocator().GetArena(), &other);
+    EXPECT_EQ(few.get_allocator().GetArena(), &arena);
+    EXPECT_EQ(many, jsonrpc::Request::Parameters{ Json(2) });
+    EXPECT_EQ(few, jsonrpc::Request::Parameters(10, Json(1)));
+
+    // a reset only keeps up to maxKeptSize of what was used
+    jsonrpc::Arena capped(64, 1024);
+    capped.Allocate(100, 8);
+    capped.Allocate(200, 8);
+    const size_t used = capped.GetCapacity();
+    capped.Reset();
+    EXPECT_EQ(capped.GetCapacity(), used);
+    capped.Allocate(1 << 16, 8);
+    capped.Reset();
+    EXPECT_EQ(capped.GetCapacity(), 1024u);
+}
+
+/// @test
+TEST_F(JsonRpcTest, SmallParameters) {
+    jsonrpc::Request::Parameters params{ Json(1), Json(2) };
+    const Json* inlineData = params.data();
+    params.insert(params.begin(), Json(0));
+    EXPECT_EQ(params.data(), inlineData);
+
+    // grows out of the inline storage, inserting a range of itself
+    params.insert(params.begin() + 1, params.begin(), params.end());
+    ASSERT_EQ(params.size(), 6u);
+    EXPECT_NE(params.data(), inlineData);
+    EXPECT_EQ(Json(Json::array(params.begin(), params.end())).dump(), "[0, 0, 1, 2, 1, 2]");
+
+    jsonrpc::Request::Parameters moved(std::move(params));
+    EXPECT_TRUE(params.empty());
+    params = moved;
+    params.erase(params.begin(), params.begin() + 3);
+    params.resize(4);
+    EXPECT_EQ(Json(Json::array(params.begin(), params.end())).dump(), "[2, 1, 2, null]");
+
+    // elements of itself, without reallocating
+    jsonrpc::Request::Parameters strings{ Json("x"), Json("y") };
+    strings.reserve(8);
+    const Json* data = strings.data();
+    strings.insert(strings.begin(), strings[1]);
+    strings.insert(strings.begin() + 1, strings.begin() + 1, strings.end());
+    EXPECT_EQ(strings.data(), data);
+    EXPECT_EQ(Json(Json::array(strings.begin(), strings.end())).dump(), "[\"y\", \"x\", \"y\", \"x\", \"y\"]");
+
+    // and while reallocating
+    strings.resize(strings.capacity() + 1, strings[0]);
+    EXPECT_NE(strings.data(), data);
+    EXPECT_EQ(strings.back(), Json("y"));
+}
+
+/// @test
+TEST_F(JsonRpcTest, InvokeTyped) {
+    jsonrpc::Server server2;
+    auto& method = server2.GetDispatcher().AddMethod("format", [](int a, double b, bool c, const std::string& d) {
+        return std::to_string(a) + " " + std::to_string(b) + " " + (c ? "yes" : "no") + " " + d;
+    });
+    EXPECT_TRUE(method.HasTypedMethod());
+    EXPECT_FALSE(server2.GetDispatcher().AddMethod("first", [](const Json::array& a) { return a.at(0); }).HasTypedMethod());
+
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"format\",\"id\":1,\"params\":[ -7 , 2.5e1, true, \"a\\\"\\u00e9\", 9]}"),
+        "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": \"-7 25.000000 yes a\\\"\xc3\xa9\"}");
+    // null is left to Json::AsType
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"format\",\"id\":2,\"params\":[1, null, false, \"\"]}"),
+        "{\"id\": 2, \"jsonrpc\": \"2.0\", \"result\": \"1 0.000000 no \"}");
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"format\",\"id\":3,\"params\":[1, 2]}"),
+        "{\"error\": {\"code\": -32602, \"message\": \"Invalid parameters, less than required least number\"}, \"id\": 3, \"jsonrpc\": \"2.0\"}");
+}
+
+/// @test
+TEST_F(JsonRpcTest, WriteTypedResult) {
+    jsonrpc::Server server2;
+    auto& d = server2.GetDispatcher();
+    d.AddMethod("int", [](int a) { return a; });
+    d.AddMethod("double", [](double a) { return a / 3; });
+    d.AddMethod("bool", [](bool a) { return !a; });
+    d.AddMethod("string", [](const std::string& a) { return a + "\n\xe2\x80\xa8"; });
+    d.AddMethod("object", [](const Json::array& a) { return Json::object{ { "b", a }, { "a", Json() } }; });
+    d.AddMethod("array", [](const Json::object& a) { return Json::array{ a, 1 }; });
+    d.AddMethod("void", [](int) {});
+
+    const char* calls[][2] = {
+        { "int", "[-42]" }, { "double", "[1]" }, { "bool", "[false]" }, { "string", "[\"x\\u0001\"]" },
+        { "object", "[[1, \"2\"]]" }, { "array", "[{\"k\": [true]}]" }, { "void", "[1]" }, { "string", "[null]" },
+    };
+    for (auto& call : calls) {
+        std::string err;
+        auto params = Json::parse(call[1], err).array_items();
+        auto expected = jsonrpc::Response(d.GetMethod(call[0])(jsonrpc::Request::Parameters(params.begin(), params.end())), Json(1));
+
+        auto response = server2.HandleRequest(std::string("{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"") + call[0] + "\",\"params\":" + call[1] + "}");
+        EXPECT_EQ(response, expected.Write().dump());
+        auto result = d.Invoke(call[0], jsonrpc::Request::Parameters(params.begin(), params.end()), Json(1));
+        EXPECT_EQ(result.GetResult(), expected.GetResult());
+    }
+}
+
+/// @test
+TEST_F(JsonRpcTest, InvokeAsync) {
+    jsonrpc::Server server2;
+    std::vector<std::pair<int, jsonrpc::AsyncResult>> pending;
+    server2.GetDispatcher().AddAsyncMethod("later", [&](const jsonrpc::Request::Parameters& params, jsonrpc::AsyncResult result) {
+        pending.emplace_back(params.at(0).int_value(), result);
+    });
+    server2.GetDispatcher().AddAsyncMethod("now", [](const jsonrpc::Request::Parameters& params, jsonrpc::AsyncResult result) {
+        if (params.empty()) {
+            throw jsonrpc::InvalidParametersFault();
+        }
+        result.SetResult(params[0]);
+    });
+    server2.GetDispatcher().AddMethod("sync", [](int a) { return a; });
+
+    std::vector<std::string> responses;
+    auto done = [&](std::string response) { responses.push_back(std::move(response)); };
+
+    server2.HandleRequestAsync("{\"jsonrpc\":\"2.0\",\"method\":\"later\",\"id\":1,\"params\":[10]}", done);
+    server2.HandleRequestAsync("[{\"jsonrpc\":\"2.0\",\"method\":\"later\",\"id\":2,\"params\":[20]},"
+        "{\"jsonrpc\":\"2.0\",\"method\":\"now\",\"id\":3,\"params\":[\"x\"]},"
+        "{\"jsonrpc\":\"2.0\",\"method\":\"now\",\"id\":4,\"params\":[]},"
+        "{\"jsonrpc\":\"2.0\",\"method\":\"sync\",\"id\":5,\"params\":[5]},"
+        "{\"jsonrpc\":\"2.0\",\"method\":\"later\",\"params\":[30]}]", done);
+    ASSERT_TRUE(responses.empty());
+    ASSERT_EQ(pending.size(), 3u);
+
+    // completed out of order, and from another thread
+    pending[1].second.SetResult(Json(pending[1].first));
+    std::thread([&] { pending[0].second.SetResult(Json(pending[0].first)); }).join();
+    ASSERT_EQ(responses.size(), 1u);
+    EXPECT_EQ(responses[0], "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": 10}");
+    pending[2].second.SetFault(jsonrpc::Fault("ignored, this is a notification"));
+    pending[2].second.SetResult(Json());
+    ASSERT_EQ(responses.size(), 2u);
+    EXPECT_EQ(responses[1], "[{\"id\": 2, \"jsonrpc\": \"2.0\", \"result\": 20}, {\"id\": 3, \"jsonrpc\": \"2.0\", \"result\": \"x\"}, "
+        "{\"error\": {\"code\": -32602, \"message\": \"Invalid parameters\"}, \"id\": 4, \"jsonrpc\": \"2.0\"}, "
+        "{\"id\": 5, \"jsonrpc\": \"2.0\", \"result\": 5}]");
+
+    // the synchronous API answers the calls completed before the method returns
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"now\",\"id\":6,\"params\":[6]}"),
+        "{\"id\": 6, \"jsonrpc\": \"2.0\", \"result\": 6}");
+    // and does not wait for the others
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"later\",\"id\":7,\"params\":[7]}"),
+        "{\"error\": {\"code\": -32001, \"message\": \"Asynchronous method not completed, call it asynchronously\"}, \"id\": 7, \"jsonrpc\": \"2.0\"}");
+    pending.back().second.SetResult(Json(7));
+
+    // a call dropped by the method is answered all the same
+    pending.clear();
+    server2.HandleRequestAsync("{\"jsonrpc\":\"2.0\",\"method\":\"later\",\"id\":8,\"params\":[8]}", done);
+    ASSERT_EQ(responses.size(), 2u);
+    pending.clear();
+    ASSERT_EQ(responses.size(), 3u);
+    EXPECT_EQ(responses[2], "{\"error\": {\"code\": -32603, \"message\": \"Internal error: the method did not complete the call\"}, \"id\": 8, \"jsonrpc\": \"2.0\"}");
+
+    // asynchronous and limited methods are answered from their cache too
+    int calls = 0;
+    server2.GetDispatcher().AddAsyncMethod("cached", [&](const jsonrpc::Request::Parameters& params, jsonrpc::AsyncResult result) {
+        ++calls;
+        result.SetResult(params.at(0));
+    }).SetCacheable(4);
+    server2.GetDispatcher().AddMethod("limited", [&](int a) { ++calls; return a * a; }).SetMaxConcurrency(1).SetCacheable(4);
+    for (int id = 9; id < 11; ++id) {
+        server2.HandleRequestAsync("{\"jsonrpc\":\"2.0\",\"method\":\"cached\",\"id\":" + std::to_string(id) + ",\"params\":[9]}", done);
+        server2.HandleRequestAsync("{\"jsonrpc\":\"2.0\",\"method\":\"limited\",\"id\":" + std::to_string(id) + ",\"params\":[4]}", done);
+    }
+    EXPECT_EQ(calls, 2);
+    ASSERT_EQ(responses.size(), 7u);
+    EXPECT_EQ(responses[5], "{\"id\": 10, \"jsonrpc\": \"2.0\", \"result\": 9}");
+    EXPECT_EQ(responses[6], "{\"id\": 10, \"jsonrpc\": \"2.0\", \"result\": 16}");
+}
+
+/// @test
+TEST_F(JsonRpcTest, ReadRequest) {
+    // members in any order, unknown members, escaped keys and values
+    jsonrpc::JsonReader reader(std::string("{\"params\":[1,[2,{\"a\":null}],\"x\"], \"extra\": {\"id\": 5},"
+        " \"id\":\"a\\\"b\", \"meth\\u006fd\":\"con\\u0063at\", \"jsonrpc\":\"2.0\"}"));
+    auto request = reader.GetRequest();
+    EXPECT_EQ(request.GetMethodName(), "concat");
+    EXPECT_EQ(request.GetId(), Json("a\"b"));
+    // writing it leaves the params unparsed
+    std::string err;
+    EXPECT_EQ(Json::parse(request.Write(), err)["params"].array_items().size(), 3u);
+    EXPECT_FALSE(request.GetRawParameters().empty());
+    ASSERT_EQ(request.GetParameters().size(), 3u);
+    EXPECT_EQ(request.GetParameters()[1].dump(), "[2, {\"a\": null}]");
+
+    jsonrpc::JsonReader notification(std::string("{\"jsonrpc\":\"2.0\",\"method\":\"m\",\"id\":null,\"params\":null}"));
+    request = notification.GetRequest();
+    EXPECT_EQ(request.GetId(), Json(false));
+    EXPECT_TRUE(request.GetParameters().empty());
+
+    EXPECT_THROW(jsonrpc::JsonReader(std::string("{\"jsonrpc\":\"2.0\",\"method\":\"m\"} x")), jsonrpc::ParseErrorFault);
+
+    // the text stays with the requests that outlive their reader
+    auto outliving = jsonrpc::JsonReader(std::string("{\"jsonrpc\":\"2.0\",\"method\":\"m\",\"id\":1,"
+        "\"params\":[\"longer than the inline storage of a string\"]}")).GetRequest();
+    ASSERT_EQ(outliving.GetParameters().size(), 1u);
+    EXPECT_EQ(outliving.GetParameters()[0], Json("longer than the inline storage of a string"));
+}
+
+/// @test
+TEST_F(JsonRpcTest, ReadFaults) {
+    const std::string truncated = "{\"jsonrpc\":\"2.0\"";
+    auto invalid = jsonrpc::JsonReader::Read(truncated);
+    ASSERT_FALSE(invalid);
+    EXPECT_EQ(invalid.GetFaultCode(), jsonrpc::Fault::PARSE_ERROR);
+    EXPECT_THROW(invalid.ThrowIfFault(), jsonrpc::ParseErrorFault);
+
+    const std::string data = "{\"jsonrpc\":\"2.0\",\"method\":\"m\",\"id\":[1]}";
+    auto reader = jsonrpc::JsonReader::Read(data);
+    ASSERT_TRUE(reader);
+    EXPECT_FALSE(reader->ReadBatch());
+    auto request = reader->ReadRequest();
+    ASSERT_FALSE(request);
+    EXPECT_EQ(request.GetFaultCode(), jsonrpc::Fault::INVALID_REQUEST);
+    EXPECT_THROW(request.GetValue(), jsonrpc::InvalidRequestFault);
+
+    auto response = dispatcher.Invoke(dispatcher.Resolve("missing"), {}, Json(1));
+    EXPECT_EQ(response.Write().dump(), "{\"error\": {\"code\": -32601, \"message\": \"Method not found: missing\"}, \"id\": 1, \"jsonrpc\": \"2.0\"}");
+    EXPECT_THROW(response.ThrowIfFault(), jsonrpc::MethodNotFoundFault);
+}
+
+/// @test
+TEST_F(JsonRpcTest, InvokeBatch) {
+    std::string err;
+    EXPECT_CALL(GlobalMock, Add(3, 2)).WillOnce(Return(5));
+    EXPECT_CALL(GlobalMock, Concat("Hello, ", "World!")).WillOnce(Return("Hello, World!"));
+    response = server.HandleRequest("[" + addRequest + "," + printNotificationRequest + "," + concatRequest + ",3]");
+    printf("response: %s\n\n", response.c_str());
+
+    auto responses = Json::parse(response, err).array_items();
+    EXPECT_TRUE(err.empty());
+    ASSERT_EQ(responses.size(), 3u);
+    EXPECT_EQ(responses[0]["id"].number_value(), 0);
+    EXPECT_EQ(responses[0]["result"].number_value(), 5);
+    EXPECT_EQ(responses[1]["id"].number_value(), 1);
+    EXPECT_EQ(responses[1]["result"].string_value(), "Hello, World!");
+    EXPECT_TRUE(responses[2]["id"].is_null());
+    EXPECT_EQ(responses[2]["error"]["code"].number_value(), jsonrpc::Fault::INVALID_REQUEST);
+
+    response = server.HandleRequest("[3,2]");
+    responses = Json::parse(response, err).array_items();
+    ASSERT_EQ(responses.size(), 2u);
+    EXPECT_EQ(responses[1]["error"]["code"].number_value(), jsonrpc::Fault::INVALID_REQUEST);
+
+    // a batch of notifications gets no response at all
+    response = server.HandleRequest("[" + printNotificationRequest + "," + printNotificationRequest + "]");
+    EXPECT_TRUE(response.empty());
+}
+
+/// @test
+TEST_F(JsonRpcTest, InvokeBatchConcurrent) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("twice", [](int a) { return 2 * a; });
+    server2.SetBatchConcurrency(4);
+
+    std::string batch = "[";
+    for (int i = 0; i < 64; ++i) {
+        batch += (i ? "," : "") + std::string("{\"jsonrpc\":\"2.0\",\"method\":\"twice\",\"id\":")
+            + std::to_string(i) + ",\"params\":[" + std::to_string(i) + "]}";
+    }
+    batch += "]";
+
+    std::string err;
+    auto responses = Json::parse(server2.HandleRequest(batch), err).array_items();
+    EXPECT_TRUE(err.empty());
+    ASSERT_EQ(responses.size(), 64u);
+    for (int i = 0; i < 64; ++i) {
+        EXPECT_EQ(responses[i]["id"].number_value(), i);
+        EXPECT_EQ(responses[i]["result"].number_value(), 2 * i);
+    }
+}
+
+/// @test
+TEST_F(JsonRpcTest, ClientPipelining) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("twice", [](int a) { return 2 * a; });
+    server2.GetDispatcher().AddMethod("nothing", []() {});
+
+    jsonrpc::Client client;
+    std::vector<std::string> results;
+    auto done = [&](jsonrpc::Response response) {
+        results.push_back(response.IsFault() ? response.GetFaultString() : response.GetResult().dump());
+    };
+    auto first = client.BuildCallData("twice", { Json(1) }, done);
+    auto second = client.BuildCallData("missing", {}, done);
+    std::future<jsonrpc::Response> third;
+    auto thirdData = client.BuildCallData("nothing", {}, third);
+    auto lost = client.BuildCallData("twice", { Json(4) }, done, std::chrono::seconds(1));
+    EXPECT_EQ(client.GetPendingCount(), 4u);
+
+    // answered out of order, in a batch and on their own
+    EXPECT_EQ(client.HandleResponseData(server2.HandleRequest(thirdData)), 1u);
+    EXPECT_EQ(client.HandleResponseData(server2.HandleRequest("[" + second + "," + first + "]")), 2u);
+    EXPECT_EQ(third.get().GetResult(), Json());
+    ASSERT_EQ(results.size(), 2u);
+    EXPECT_EQ(results[0], "Method not found: missing");
+    EXPECT_EQ(results[1], "2");
+    // already answered
+    EXPECT_EQ(client.HandleResponseData(server2.HandleRequest(first)), 0u);
+    EXPECT_THROW(client.HandleResponseData("{\"id\": 1}"), jsonrpc::InvalidRequestFault);
+
+    EXPECT_EQ(client.ExpireCalls(), 0u);
+    EXPECT_LE(client.GetNextDeadline(), jsonrpc::Client::Clock::now() + std::chrono::seconds(1));
+    EXPECT_EQ(client.ExpireCalls(jsonrpc::Client::Clock::now() + std::chrono::seconds(2)), 1u);
+    ASSERT_EQ(results.size(), 3u);
+    EXPECT_EQ(results[2], "Request timed out");
+    EXPECT_EQ(client.HandleResponseData(server2.HandleRequest(lost)), 0u);
+    EXPECT_EQ(client.GetPendingCount(), 0u);
+    EXPECT_EQ(client.GetNextDeadline(), jsonrpc::Client::Clock::time_point::max());
+
+    // a call answered in time leaves no deadline behind
+    auto answered = client.BuildCallData("twice", { Json(5) }, done, std::chrono::seconds(1));
+    EXPECT_EQ(client.HandleResponseData(server2.HandleRequest(answered)), 1u);
+    EXPECT_EQ(client.GetNextDeadline(), jsonrpc::Client::Clock::time_point::max());
+}
+
+/// @test
+TEST_F(JsonRpcTest, ClientBatch) {
+    jsonrpc::Server server2;
+    int notified = 0;
+    server2.GetDispatcher().AddMethod("twice", [](int a) { return 2 * a; });
+    server2.GetDispatcher().AddMethod("notify", [&](std::string) { ++notified; });
+
+    jsonrpc::Client client;
+    jsonrpc::Client::BatchBuilder batch(client);
+    batch.AddCall("twice", { Json(3) });
+    batch.AddNotification("notify", { Json("a\"b") });
+    EXPECT_EQ(batch.GetData(), "[{\"id\": 0, \"jsonrpc\": \"2.0\", \"method\": \"twice\", \"params\": [3]}, "
+        "{\"jsonrpc\": \"2.0\", \"method\": \"notify\", \"params\": [\"a\\\"b\"]}]");
+    batch.AddCall("missing");
+    std::string pipelined;
+    batch.AddCall("twice", { Json(5) }, [&](jsonrpc::Response response) { pipelined = response.GetResult().dump(); });
+    EXPECT_EQ(batch.GetSize(), 4u);
+    ASSERT_EQ(batch.GetIds().size(), 3u);
+
+    auto data = server2.HandleRequest(batch.GetData());
+    EXPECT_EQ(notified, 1);
+    auto responses = client.ParseBatchResponse(data, batch);
+    ASSERT_EQ(responses.size(), 3u);
+    EXPECT_EQ(responses[0].GetResult(), Json(6));
+    EXPECT_EQ(responses[1].GetFaultCode(), jsonrpc::Fault::METHOD_NOT_FOUND);
+    EXPECT_EQ(responses[2].GetId(), Json(batch.GetIds()[2]));
+    EXPECT_EQ(client.HandleResponseData(data), 1u);
+    EXPECT_EQ(pipelined, "10");
+
+    // the server could not read it at all
+    responses = client.ParseBatchResponse(server2.HandleRequest(batch.GetData().substr(1)), batch);
+    ASSERT_EQ(responses.size(), 3u);
+    EXPECT_EQ(responses[1].GetFaultCode(), jsonrpc::Fault::PARSE_ERROR);
+
+    batch.Clear();
+    EXPECT_EQ(batch.GetData(), "[]");
+
+    // the server answers nothing to notifications only
+    batch.AddNotification("notify", { Json("c") });
+    data = server2.HandleRequest(batch.GetData());
+    EXPECT_EQ(data, "");
+    EXPECT_TRUE(client.ParseBatchResponse(data, batch).empty());
+    EXPECT_EQ(notified, 2);
+}
+
+/// @test
+TEST_F(JsonRpcTest, ClientCallTemplate) {
+    jsonrpc::Client client;
+    auto call = client.PrepareCall("con\"cat");
+    std::string out;
+    EXPECT_EQ(call.Write(out, 1, "two", 3.5, true, Json::array{ Json(4) }), 0);
+    EXPECT_EQ(out, "{\"id\": 0, \"jsonrpc\": \"2.0\", \"method\": \"con\\\"cat\", \"params\": [1, \"two\", 3.5, true, [4]]}");
+    // the same call as built through Json, but for the id
+    std::string error;
+    Json written = Json::parse(out, error);
+    Json built = Json::parse(client.BuildRequestData("con\"cat", 1, "two", 3.5, true, Json::array{ Json(4) }), error);
+    EXPECT_EQ(written["method"], built["method"]);
+    EXPECT_EQ(written["params"], built["params"]);
+
+    // the buffer is reused
+    EXPECT_EQ(call.Write(out, jsonrpc::Request::Parameters{ Json(1), Json("x") }), 2);
+    EXPECT_EQ(out, "{\"id\": 2, \"jsonrpc\": \"2.0\", \"method\": \"con\\\"cat\", \"params\": [1, \"x\"]}");
+    call.WriteNotification(out);
+    EXPECT_EQ(out, client.BuildNotificationData("con\"cat"));
+
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("add", [](int a, int b) { return a + b; });
+    auto add = client.PrepareCall("add");
+    int sum = 0;
+    add.WritePipelined(out, [&](jsonrpc::Response response) { sum = response.GetResult().int_value(); },
+        jsonrpc::Client::Clock::duration::zero(), 2, 3);
+    EXPECT_EQ(client.HandleResponseData(server2.HandleRequest(out)), 1u);
+    EXPECT_EQ(sum, 5);
+}
+
+/// @test
+TEST_F(JsonRpcTest, StreamParser) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("echo", [](std::string s) { return s; });
+
+    const std::string stream = "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":1,\"params\":[\"}{\\\"\"]}\r\n"
+        "[{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":2,\"params\":[\"[\"]}]"
+        "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"params\":[\"\"]}  \n{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":3,\"params\":[\"x\"]}";
+    const std::string expected = "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": \"}{\\\"\"}"
+        "[{\"id\": 2, \"jsonrpc\": \"2.0\", \"result\": \"[\"}]"
+        "{\"id\": 3, \"jsonrpc\": \"2.0\", \"result\": \"x\"}";
+
+    // whatever the chunks the stream is cut into
+    for (size_t chunk = 1; chunk <= stream.size(); ++chunk) {
+        jsonrpc::StreamParser parser;
+        std::string responses;
+        for (size_t offset = 0; offset < stream.size(); offset += chunk) {
+            ASSERT_TRUE(parser.Feed(stream.data() + offset, std::min(chunk, stream.size() - offset),
+                [&](jsonrpc::StringRef message) { server2.HandleRequest(message, responses); }));
+        }
+        EXPECT_TRUE(parser.IsIdle());
+        EXPECT_EQ(responses, expected);
+    }
+
+    jsonrpc::StreamParser parser(16);
+    auto ignore = [](jsonrpc::StringRef) {};
+    EXPECT_TRUE(parser.Feed("{\"a\": 1}", ignore));
+    EXPECT_TRUE(parser.Feed("{\"a\": [1, 2,", ignore));
+    EXPECT_FALSE(parser.Feed(" 3, 4]}", ignore));
+    parser.Reset();
+    EXPECT_FALSE(parser.Feed(" 1", ignore));
+}
+
+/// @test
+TEST_F(JsonRpcTest, Framing) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("echo", [](std::string s) { return s; });
+    auto request = [](const std::string& s) {
+        return "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":1,\"params\":[\"" + s + "\"]}";
+    };
+    auto response = [](const std::string& s) { return "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": \"" + s + "\"}"; };
+    auto receive = [](int fd) {
+        char buffer[4096];
+        ssize_t size = read(fd, buffer, sizeof(buffer));
+        return std::string(buffer, size > 0 ? size : 0);
+    };
+    auto send = [](int fd, const std::string& data) {
+        ASSERT_EQ(write(fd, data.data(), data.size()), static_cast<ssize_t>(data.size()));
+    };
+
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    {
+        jsonrpc::FramedConnection connection(server2, fds[1], jsonrpc::Framing::NEWLINE_DELIMITED);
+        const std::string second = request("b");
+        send(fds[0], request("a") + "\r\n\n" + second.substr(0, 10));
+        ASSERT_TRUE(connection.Process());
+        EXPECT_EQ(receive(fds[0]), response("a") + "\n");
+        send(fds[0], second.substr(10) + "\n{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"params\":[\"\"]}\n" + request("c") + "\n");
+        ASSERT_TRUE(connection.Process());
+        EXPECT_EQ(receive(fds[0]), response("b") + "\n" + response("c") + "\n");
+        close(fds[0]);
+        EXPECT_FALSE(connection.Process());
+    }
+    close(fds[1]);
+
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    {
+        jsonrpc::FramedConnection connection(server2, fds[1], jsonrpc::Framing::NETSTRING);
+        const std::string first = request("a,b");
+        send(fds[0], std::to_string(first.size()) + ":" + first + "," + std::to_string(first.size()) + ":" + first.substr(0, 5));
+        ASSERT_TRUE(connection.Process());
+        send(fds[0], first.substr(5) + ",");
+        ASSERT_TRUE(connection.Process());
+        const std::string answer = response("a,b");
+        const std::string framed = std::to_string(answer.size()) + ":" + answer + ",";
+        EXPECT_EQ(receive(fds[0]), framed + framed);
+
+        send(fds[0], "3:abc;");
+        EXPECT_FALSE(connection.Process());
+        close(fds[0]);
+    }
+    close(fds[1]);
+
+    // in-memory pipes, one each way
+    int in[2], out[2];
+    ASSERT_EQ(pipe(in), 0);
+    ASSERT_EQ(pipe(out), 0);
+    {
+        jsonrpc::FramedConnection connection(server2, in[0], out[1], jsonrpc::Framing::NEWLINE_DELIMITED);
+        send(in[1], request("p") + "\n");
+        ASSERT_TRUE(connection.Process());
+        EXPECT_EQ(receive(out[0]), response("p") + "\n");
+    }
+    for (int fd : { in[0], in[1], out[0], out[1] }) {
+        close(fd);
+    }
+}
+
+/// @test
+TEST_F(JsonRpcTest, SocketServer) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("echo", [](std::string s) { return s; });
+    const std::string path = "/tmp/jsonrpc-lean-test-" + std::to_string(getpid()) + ".sock";
+
+    jsonrpc::SocketServer socketServer(server2);
+    socketServer.SetLoops(2);
+    socketServer.SetMaxPendingOutput(1024);
+    socketServer.ListenTcp("127.0.0.1", 0);
+    socketServer.ListenUnix(path);
+    ASSERT_NE(socketServer.GetTcpPort(), 0);
+    std::thread loop([&socketServer] { socketServer.Run(); });
+    // stops the loops on failed assertions too
+    struct LoopGuard {
+        ~LoopGuard() {
+            server.Stop();
+            thread.join();
+        }
+        jsonrpc::SocketServer& server;
+        std::thread& thread;
+    } guard{ socketServer, loop };
+
+    // many pipelined requests, answered in order, more than the pending output limit
+    auto roundTrip = [](int fd) {
+        std::string requests;
+        std::string expected;
+        for (int i = 0; i < 200; ++i) {
+            const std::string s = std::to_string(i);
+            requests += "{\"jsonrpc\":\"2.0\",\"method\":\"echo\",\"id\":" + s + ",\"params\":[\"" + s + "\"]}\n";
+            expected += "{\"id\": " + s + ", \"jsonrpc\": \"2.0\", \"result\": \"" + s + "\"}\n";
+        }
+        ASSERT_EQ(write(fd, requests.data(), requests.size()), static_cast<ssize_t>(requests.size()));
+        std::string received;
+        char buffer[4096];
+        while (received.size() < expected.size()) {
+            const ssize_t size = read(fd, buffer, sizeof(buffer));
+            ASSERT_GT(size, 0);
+            received.append(buffer, size);
+        }
+        EXPECT_EQ(received, expected);
+        close(fd);
+    };
+
+    sockaddr_in tcp;
+    memset(&tcp, 0, sizeof(tcp));
+    tcp.sin_family = AF_INET;
+    tcp.sin_port = htons(socketServer.GetTcpPort());
+    tcp.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&tcp), sizeof(tcp)), 0);
+    roundTrip(fd);
+
+    sockaddr_un local;
+    memset(&local, 0, sizeof(local));
+    local.sun_family = AF_UNIX;
+    strcpy(local.sun_path, path.c_str());
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_EQ(connect(fd, reinterpret_cast<sockaddr*>(&local), sizeof(local)), 0);
+    roundTrip(fd);
+}
+
+/// @test
+TEST_F(JsonRpcTest, BinaryParameters) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("reverse", [](const jsonrpc::Binary& data) {
+        std::string reversed(data.data(), data.size());
+        std::reverse(reversed.begin(), reversed.end());
+        return jsonrpc::Binary(std::move(reversed));
+    });
+
+    std::string data;
+    for (int i = 0; i < 1000; ++i) {
+        data += static_cast<char>(i * 7);
+    }
+    std::string reversed(data.rbegin(), data.rend());
+
+    // a wrapped encoding, with its line breaks and slashes escaped
+    const std::string wrapped = jsonrpc::util::Base64Encode(data);
+    ASSERT_NE(wrapped.find("\r\n"), std::string::npos);
+    std::string escaped;
+    jsonrpc::JsonWriter(escaped).String(wrapped);
+    std::string response;
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"reverse\",\"id\":1,\"params\":[" + escaped + "]}", response);
+    std::string expected = "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": \"";
+    jsonrpc::util::Base64EncodeAppend(reversed.data(), reversed.size(), expected, 0);
+    EXPECT_EQ(response, expected + "\"}");
+
+    // through Json
+    auto result = server2.GetDispatcher().Invoke("reverse", { jsonrpc::Binary(data.data(), data.size()) }, Json(2));
+    ASSERT_FALSE(result.IsFault());
+    EXPECT_EQ(jsonrpc::util::Base64Decode(result.GetResult().string_value()), reversed);
+
+    // a thread keeps one large buffer for the next large blob
+    const std::string large = jsonrpc::util::Base64Encode(std::string(1 << 20, 'x'));
+    const char* buffer = nullptr;
+    {
+        auto binary = jsonrpc::Binary::Decode(large.data(), large.size());
+        ASSERT_EQ(binary.size(), 1u << 20);
+        buffer = binary.data();
+    }
+    EXPECT_EQ(jsonrpc::Binary::Decode(large.data(), large.size()).data(), buffer);
+
+    for (size_t size = 0; size < 200; ++size) {
+        const std::string encoded = jsonrpc::util::Base64Encode(data.data(), size);
+        ASSERT_EQ(encoded.size(), jsonrpc::util::Base64EncodedSize(size));
+        EXPECT_EQ(jsonrpc::util::Base64Decode(encoded), data.substr(0, size));
+    }
+}
+
+/// @test
+TEST_F(JsonRpcTest, Base64Streaming) {
+    EXPECT_EQ(jsonrpc::util::Base64Encode("Man", 3), "TWFu");
+    EXPECT_EQ(jsonrpc::util::Base64Decode("TW\r\nE=", 7), "Ma");
+
+    std::string data;
+    uint32_t seed = 1;
+    for (int i = 0; i < 1500; ++i) {
+        seed = seed * 1103515245 + 12345;
+        data += static_cast<char>(seed >> 16);
+    }
+
+    // chunks of one byte leave nothing to the vector code, compare it to them
+    for (size_t size : { 0, 1, 2, 3, 56, 57, 58, 95, 96, 100, 1000, 1499, 1500 }) {
+        for (size_t lineLength : { 0, 76, 64 }) {
+            const std::string encoded = [&] {
+                std::string str;
+                jsonrpc::util::Base64EncodeAppend(data.data(), size, str, lineLength);
+                return str;
+            }();
+            jsonrpc::util::Base64Encoder encoder(lineLength);
+            std::string streamed;
+            for (size_t i = 0; i < size; ++i) {
+                encoder.Update(data.data() + i, 1, streamed);
+            }
+            encoder.Finish(streamed);
+            ASSERT_EQ(streamed, encoded) << size << " " << lineLength;
+
+            ASSERT_EQ(jsonrpc::util::Base64Decode(encoded), data.substr(0, size));
+            jsonrpc::util::Base64Decoder decoder;
+            std::string decoded;
+            for (size_t i = 0; i < encoded.size(); i += 7) {
+                decoder.Update(encoded.data() + i, std::min<size_t>(7, encoded.size() - i), decoded);
+            }
+            decoder.Finish(decoded);
+            ASSERT_EQ(decoded, data.substr(0, size));
+        }
+    }
+
+    // the characters skipped by the scalar code, within vector blocks
+    std::string noisy = jsonrpc::util::Base64Encode(data.data(), 999);
+    noisy.insert(40, " ");
+    noisy.insert(200, "*");
+    EXPECT_EQ(jsonrpc::util::Base64Decode(noisy), data.substr(0, 999));
+}
+
+/// @test
+TEST_F(JsonRpcTest, MethodStats) {
+    jsonrpc::Server server2;
+    auto& dispatcher = server2.GetDispatcher();
+    dispatcher.AddMethod("add", [](int a, int b) { return a + b; });
+    dispatcher.AddMethod("fail", [](int) -> int { throw jsonrpc::Fault("failed", 42); });
+    dispatcher.AddStatsMethod();
+
+    for (int i = 0; i < 10; ++i) {
+        server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":1,\"params\":[1,2]}");
+    }
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":1,\"params\":[1]}");
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"fail\",\"id\":1,\"params\":[1]}");
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"missing\",\"id\":1}");
+
+    auto stats = dispatcher.GetStats();
+    EXPECT_EQ(stats.count("missing"), 0u);
+    EXPECT_FALSE(dispatcher.GetMethodNames() == dispatcher.GetMethodNames(true));
+#ifndef JSONRPC_LEAN_DISABLE_STATS
+    const auto& add = stats.at("add");
+    EXPECT_EQ(add.calls, 11u);
+    EXPECT_EQ(add.faults, 1u);
+    EXPECT_EQ(add.faultCodes.at(-32602), 1u);
+    EXPECT_LE(add.GetPercentileNanoseconds(50), add.GetPercentileNanoseconds(99));
+    EXPECT_LE(add.GetPercentileNanoseconds(99), add.maxNanoseconds);
+    EXPECT_EQ(std::accumulate(add.histogram.begin(), add.histogram.end(), uint64_t(0)), 11u);
+    EXPECT_EQ(stats.at("fail").faultCodes.at(42), 1u);
+
+    std::string err;
+    Json result = Json::parse(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"system.stats\",\"id\":1}"), err)["result"];
+    EXPECT_EQ(result["add"]["calls"].number_value(), 11);
+    EXPECT_EQ(result["fail"]["fault_codes"]["42"].number_value(), 1);
+#endif
+
+    // buckets are contiguous, with four per power of two
+    for (uint64_t value : { 0, 63, 64, 80, 95, 96, 1000, 123456789 }) {
+        const size_t bucket = jsonrpc::MethodStats::GetBucket(value);
+        EXPECT_LE(value, jsonrpc::MethodStats::GetUpperBound(bucket));
+        EXPECT_TRUE(bucket == 0 || value >= jsonrpc::MethodStats::GetUpperBound(bucket - 1));
+    }
+}
+
+/// @test
+TEST_F(JsonRpcTest, Tracer) {
+    struct Recorder : jsonrpc::Tracer {
+        void Begin(Stage stage, const Json& id, const std::string& method) override {
+            events.push_back(std::string("B ") + GetStageName(stage) + " " + id.dump() + " " + method);
+        }
+        void End(Stage stage, const Json& id, const std::string& method, Clock::time_point start) override {
+            EXPECT_LE(start, Clock::now());
+            events.push_back(std::string("E ") + GetStageName(stage) + " " + id.dump() + " " + method);
+        }
+        std::vector<std::string> events;
+    };
+
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("add", [](int a, int b) { return a + b; });
+    auto recorder = std::make_shared<Recorder>();
+    server2.SetTracer(recorder);
+
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":7,\"params\":[1,2]}");
+    EXPECT_EQ(recorder->events, std::vector<std::string>({
+        "B parse null ", "E parse 7 add",
+        "B dispatch 7 add", "E dispatch 7 add",
+        "B serialize 7 add", "E serialize 7 add" }));
+
+    // the batch is parsed, then each of its requests
+    recorder->events.clear();
+    server2.HandleRequest("[{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"params\":[1,2]},{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":8,\"params\":[1,2]}]");
+    EXPECT_EQ(recorder->events, std::vector<std::string>({
+        "B parse null ", "E parse null ",
+        "B parse null ", "E parse false add", "B dispatch false add", "E dispatch false add",
+        "B parse null ", "E parse 8 add", "B dispatch 8 add", "E dispatch 8 add",
+        "B serialize 8 add", "E serialize 8 add" }));
+
+    recorder->events.clear();
+    std::string response;
+    server2.HandleRequestAsync("{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":9,\"params\":[1,2]}", [&](std::string r) { response = r; });
+    EXPECT_EQ(response, "{\"id\": 9, \"jsonrpc\": \"2.0\", \"result\": 3}");
+    EXPECT_EQ(recorder->events.size(), 6u);
+    EXPECT_EQ(recorder->events.back(), "E serialize 9 add");
+
+    char path[] = "/tmp/jsonrpc-trace-XXXXXX";
+    close(mkstemp(path));
+    {
+        auto writer = std::make_shared<jsonrpc::ChromeTraceWriter>(path, 0);
+        server2.SetTracer(writer);
+        server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":\"a\\\"b\",\"params\":[1,2]}");
+        server2.SetTracer(nullptr);
+    }
+    std::ifstream file(path);
+    std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    unlink(path);
+    std::string err;
+    Json trace = Json::parse(text, err);
+    ASSERT_TRUE(err.empty()) << err << text;
+    const auto& events = trace["traceEvents"].array_items();
+    ASSERT_EQ(events.size(), 3u);
+    EXPECT_EQ(events[0]["name"].string_value(), "parse");
+    EXPECT_EQ(events[2]["name"].string_value(), "serialize");
+    EXPECT_EQ(events[2]["ph"].string_value(), "X");
+    EXPECT_EQ(events[2]["args"]["id"].string_value(), "a\"b");
+    EXPECT_EQ(events[2]["args"]["method"].string_value(), "add");
+    EXPECT_LE(events[0]["ts"].number_value(), events[1]["ts"].number_value());
+}
+
+/// @test
+TEST_F(JsonRpcTest, CacheableMethod) {
+    jsonrpc::Server server2;
+    auto& dispatcher = server2.GetDispatcher();
+    std::atomic<int> calls(0);
+    dispatcher.AddMethod("lookup", [&](const std::string& key, int n) {
+        ++calls;
+        if (n < 0) {
+            throw jsonrpc::Fault("negative", 1);
+        }
+        return Json::object{ { "key", key }, { "n", n } };
+    }).SetCacheable(2);
+    dispatcher.AddAlias("lookup", "lookup_a", std::string("a"));
+
+    const std::string expected = "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": {\"key\": \"a b\", \"n\": 1}}";
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"lookup\",\"id\":1,\"params\":[\"a b\",1]}"), expected);
+    // the same parameters, laid out differently
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"lookup\",\"id\":1,\"params\": [ \"a b\" , 1 ] }"), expected);
+    EXPECT_EQ(dispatcher.Invoke("lookup", { Json("a b"), Json(1) }, Json(1)).GetResultText(), "{\"key\": \"a b\", \"n\": 1}");
+    EXPECT_EQ(calls, 1);
+
+    // faults are not kept
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"lookup\",\"id\":2,\"params\":[\"a\",-1]}");
+    server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"lookup\",\"id\":2,\"params\":[\"a\",-1]}");
+    EXPECT_EQ(calls, 3);
+
+    // aliases are keyed by their parameters too
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"lookup_a\",\"id\":3,\"params\":[1]}"),
+        "{\"id\": 3, \"jsonrpc\": \"2.0\", \"result\": {\"key\": \"a\", \"n\": 1}}");
+    EXPECT_EQ(calls, 4);
+
+    // the least recently used result is evicted
+    dispatcher.Invoke("lookup", { Json("c"), Json(1) }, Json(1));
+    EXPECT_EQ(calls, 5);
+    auto& lookup = dispatcher.GetMethod("lookup");
+    jsonrpc::ResultCache& cache = *lookup.GetResultCache();
+    EXPECT_EQ(cache.GetSize(), 2u);
+    EXPECT_TRUE(cache.Find(jsonrpc::ResultCache::GetKey(jsonrpc::StringRef("[\"a\", 1]"))) != nullptr);
+    EXPECT_TRUE(cache.Find(jsonrpc::ResultCache::GetKey(jsonrpc::StringRef("[\"a b\", 1]"))) == nullptr);
+    EXPECT_EQ(jsonrpc::ResultCache::GetKey(jsonrpc::StringRef("[ \"a \\\" b\" ,{ \"c\" : 1 } ]")), "[\"a \\\" b\",{\"c\":1}]");
+
+    // and results expire
+    lookup.SetCacheable(10, std::chrono::milliseconds(20));
+    dispatcher.Invoke("lookup", { Json("b"), Json(1) }, Json(1));
+    dispatcher.Invoke("lookup", { Json("b"), Json(1) }, Json(1));
+    EXPECT_EQ(calls, 6);
+    std::this_thread::sleep_for(std::chrono::milliseconds(30));
+    dispatcher.Invoke("lookup", { Json("b"), Json(1) }, Json(1));
+    EXPECT_EQ(calls, 7);
+}
+
+/// @test
+TEST_F(JsonRpcTest, HandleOutlivesChanges) {
+    jsonrpc::Dispatcher d;
+    d.AddMethod("version", []() { return 1; });
+    d.AddAlias("version", "current");
+    auto handle = d.Resolve("current");
+    auto later = d.Resolve("later");
+
+    // every change frees the previous registrations
+    d.AddMethod("other", []() { return 0; });
+    EXPECT_EQ(handle.GetName(), "version");
+    EXPECT_EQ(d.Invoke(handle, {}, Json(1)).GetResult(), Json(1));
+
+    // a stale handle calls what is now registered under its name
+    d.ReplaceMethod("version", []() { return 2; });
+    d.AddMethod("later", []() { return 3; });
+    EXPECT_EQ(d.Invoke(handle, {}, Json(1)).GetResult(), Json(2));
+    EXPECT_EQ(d.Invoke(later, {}, Json(1)).GetResult(), Json(3));
+    EXPECT_EQ(d.Invoke(jsonrpc::MethodHandle(), {}, Json(1)).GetFaultCode(), jsonrpc::Fault::METHOD_NOT_FOUND);
+}
+
+/// @test
+TEST_F(JsonRpcTest, ChangeAddedMethod) {
+    jsonrpc::Dispatcher d;
+    auto& added = d.AddMethod("sum", [](int a, int b) { return a + b; });
+    EXPECT_EQ(&d.GetMethod("sum"), &added);
+    auto handle = d.Resolve("sum");
+
+    // the setters change the added wrapper and publish a copy of it, the
+    // calls that found the previous one keep it
+    EXPECT_EQ(&added.SetHidden(), &added);
+    added.SetHelpText("Adds two integers");
+    EXPECT_TRUE(added.IsHidden());
+    EXPECT_FALSE(handle.GetMethod()->IsHidden());
+    EXPECT_EQ(d.Resolve("sum").GetMethod()->GetHelpText(), "Adds two integers");
+    EXPECT_TRUE(d.GetMethodNames().empty());
+
+    // and the copies share their stats
+    EXPECT_EQ(d.Invoke("sum", { Json(1), Json(2) }, Json(1)).GetResult(), Json(3));
+    EXPECT_EQ(handle.GetMethod()->GetStats().GetSnapshot().calls, 1u);
+    EXPECT_EQ(added.GetStats().GetSnapshot().calls, 1u);
+
+    // methods may change the registrations, even while holding their turn
+    d.AddMethod("register", [&d](std::string name) { d.AddMethod(name, []() { return 1; }).SetHelpText("Added"); })
+        .SetMaxConcurrency(1);
+    EXPECT_FALSE(d.Invoke("register", { Json("one") }, Json(1)).IsFault());
+    EXPECT_EQ(d.Invoke("one", {}, Json(1)).GetResult(), Json(1));
+
+    // a handle outlives the wrapper it found
+    d.ReplaceMethod("sum", [](int a, int b) { return a - b; });
+    EXPECT_EQ(d.Invoke(handle, { Json(1), Json(2) }, Json(1)).GetResult(), Json(-1));
+}
+
+/// @test
+TEST_F(JsonRpcTest, BatchRegistration) {
+    jsonrpc::Dispatcher d;
+    {
+        jsonrpc::Dispatcher::Batch batch(d);
+        for (int i = 0; i < 1000; ++i) {
+            d.AddMethod("method" + std::to_string(i), [i]() { return i; });
+        }
+        d.AddAlias("method7", "seven");
+        // published once the batch ends
+        EXPECT_TRUE(d.Invoke("seven", {}, Json(1)).IsFault());
+        EXPECT_TRUE(d.GetMethodNames().empty());
+    }
+    EXPECT_EQ(d.GetMethodNames().size(), 1000u);
+    EXPECT_EQ(d.Invoke("seven", {}, Json(1)).GetResult(), Json(7));
+    EXPECT_EQ(d.Invoke("method999", {}, Json(1)).GetResult(), Json(999));
+}
+
+/// @test
+TEST_F(JsonRpcTest, OverriddenInvoke) {
+    class PrefixingDispatcher : public jsonrpc::Dispatcher {
+    public:
+        jsonrpc::Response Invoke(std::string name, jsonrpc::Request::Parameters parameters, const Json& id) const override {
+            return jsonrpc::Dispatcher::Invoke("prefixed." + name, std::move(parameters), id);
+        }
+    };
+
+    std::unique_ptr<jsonrpc::Dispatcher> dispatcher2(new PrefixingDispatcher());
+    dispatcher2->AddMethod("prefixed.add", [](int a, int b) { return a + b; });
+    jsonrpc::Server server2(std::move(dispatcher2));
+    EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"add\",\"id\":1,\"params\":[3,2]}"),
+        "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": 5}");
+}
+
+/// @test
+TEST_F(JsonRpcTest, ReplaceMethod) {
+    jsonrpc::Server server2;
+    server2.GetDispatcher().AddMethod("version", []() { return 1; });
+    EXPECT_THROW(server2.GetDispatcher().AddMethod("version", []() { return 2; }), std::invalid_argument);
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> unexpected(0);
+    std::thread caller([&] {
+        while (!stop) {
+            auto response = server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"version\",\"id\":1}");
+            if (response.find("\"result\": ") == std::string::npos && response.find("Method not found") == std::string::npos) {
+                ++unexpected;
+            }
+        }
+    });
+
+    for (int i = 2; i < 50; ++i) {
+        server2.GetDispatcher().ReplaceMethod("version", [i]() { return i; });
+        server2.GetDispatcher().AddAlias("version", "alias" + std::to_string(i));
+        if (i % 10 == 0) {
+            server2.GetDispatcher().RemoveMethod("version");
+            server2.GetDispatcher().AddMethod("version", [i]() { return i; });
+        }
+        // no call runs the previous method once replaced
+        EXPECT_EQ(server2.HandleRequest("{\"jsonrpc\":\"2.0\",\"method\":\"version\",\"id\":1}"),
+            "{\"id\": 1, \"jsonrpc\": \"2.0\", \"result\": " + std::to_string(i) + "}");
+    }
+    stop = true;
+    caller.join();
+    EXPECT_EQ(unexpected, 0);
+    EXPECT_EQ(server2.GetDispatcher().GetMethodNames().size(), 1u);
+}
+
+/// @test
+TEST_F(JsonRpcTest, Executor) {
+    jsonrpc::Server server2;
+    std::atomic<int> running(0);
+    std::atomic<int> maxRunning(0);
+    server2.GetDispatcher().AddMethod("limited", [&](int a) {
+        int now = ++running;
+        for (int seen = maxRunning; now > seen && !maxRunning.compare_exchange_weak(seen, now);) {
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        --running;
+        return a;
+    }).SetMaxConcurrency(2);
+    server2.GetDispatcher().AddMethod("twice", [](int a) { return 2 * a; });
+
+    std::mutex mutex;
+    std::condition_variable finished;
+    std::vector<std::string> responses(64);
+    size_t remaining = responses.size();
+    {
+        jsonrpc::Executor executor(server2, 4);
+        server2.GetDispatcher().GetMethod("limited").SetMaxConcurrency(2, &executor.GetPool());
+        for (size_t i = 0; i < responses.size(); ++i) {
+            executor.Submit(std::string("{\"jsonrpc\":\"2.0\",\"method\":\"") + (i % 2 ? "twice" : "limited")
+                + "\",\"id\":" + std::to_string(i) + ",\"params\":[" + std::to_string(i) + "]}", [&, i](std::string response) {
+                std::lock_guard<std::mutex> lock(mutex);
+                responses[i] = std::move(response);
+                --remaining;
+                finished.notify_one();
+            });
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [&] { return remaining == 0; });
+
+        // a worker waiting on its own pool runs the work itself
+        std::atomic<size_t> sum(0);
+        std::promise<void> done;
+        executor.GetPool().Post([&] {
+            executor.GetPool().ParallelFor(100, [&](size_t i) { sum += i; });
+            done.set_value();
+        });
+        done.get_future().wait();
+        EXPECT_EQ(sum, 4950u);
+    }
+    EXPECT_GE(jsonrpc::Executor::GetDefaultThreads(), 1u);
+
+    EXPECT_LE(maxRunning, 2);
+    for (size_t i = 0; i < responses.size(); ++i) {
+        EXPECT_EQ(responses[i], "{\"id\": " + std::to_string(i) + ", \"jsonrpc\": \"2.0\", \"result\": "
+            + std::to_string(i % 2 ? 2 * i : i) + "}");
+    }
+}
+
+
+/// @test
+TEST_F(JsonRpcTest, ConcurrencyLimit) {
+    jsonrpc::ConcurrencyLimit limit(1);
+    std::vector<std::string> order;
+    limit.Post([&] { order.push_back("first"); });
+    limit.Post([&] { order.push_back("queued"); limit.Release(); });
+
+    // a synchronous caller waits behind the queued call, and is woken
+    std::atomic<bool> acquired(false);
+    std::thread waiter([&] {
+        jsonrpc::ConcurrencyLimit::Slot slot(&limit);
+        acquired = true;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    EXPECT_FALSE(acquired);
+    limit.Release();
+    waiter.join();
+    EXPECT_TRUE(acquired);
+    EXPECT_EQ(order, (std::vector<std::string>{ "first", "queued" }));
+}
 
 class JsonRpcErrorTest: public ::testing::TestWithParam<
         std::tr1::tuple<std::string, std::string, jsonrpc::Fault::ReservedCodes>> {
@@ -219,7 +1346,7 @@ class JsonRpcErrorTest: public ::testing::TestWithParam<
 };
 
 INSTANTIATE_TEST_CASE_P(Errors, JsonRpcErrorTest, ::testing::Values(
-        std::make_tuple("[3,2]", "Invalid request", jsonrpc::Fault::INVALID_REQUEST),
+        std::make_tuple("[]", "Invalid request", jsonrpc::Fault::INVALID_REQUEST),
         std::make_tuple("{\"parse error",
                 "Parse error: unexpected end of input in string",
                 jsonrpc::Fault::PARSE_ERROR),